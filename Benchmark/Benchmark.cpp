@@ -0,0 +1,724 @@
+#include "pch.h"
+
+// Headless render benchmark. Builds synthetic home feeds of configurable size, renders them
+// with SDL's software renderer into a hidden window and reports per-frame costs.
+//
+// Usage: YouTubeTVBenchmark [--shelves 10,100,1000] [--items 10,100] [--frames 300] [--warmup 30]
+//                           [--navigate] [--csv results.csv]
+//        YouTubeTVBenchmark --decode    compares UTF-8 decoding with the former codecvt based one
+//        YouTubeTVBenchmark --connections http://localhost:8000
+//                                       requests the origin's root in waves and reports connection reuse
+//        YouTubeTVBenchmark --http-cache
+//                                       checks HttpCache against canned responses, exits with 1 if one fails
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <locale>
+#include <new>
+#include <numeric>
+#include <sstream>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_image.h>
+#include <nlohmann/json.hpp>
+
+#include "YouTubeCore.h"
+#include "Renderer.h"
+#include "TextRenderer.h"
+#include "FontManager.h"
+#include "ImageManager.h"
+#include "ConnectionPool.h"
+#include "HttpCache.h"
+#include "LayerCache.h"
+#include "TextureManager.h"
+#include "YouTubeUI.h"
+#include "Utf8.h"
+
+#undef main
+
+using namespace std::chrono_literals;
+using namespace std::string_literals;
+
+using namespace YouTube;
+
+namespace
+{
+	std::atomic<uint64_t> allocation_count{ 0 };
+	std::atomic<uint64_t> allocation_bytes{ 0 };
+}
+
+void* operator new(std::size_t size)
+{
+	++allocation_count;
+	allocation_bytes += size;
+	if (auto ptr = std::malloc(size ? size : 1))
+		return ptr;
+	throw std::bad_alloc{};
+}
+
+void operator delete(void* ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept
+{
+	std::free(ptr);
+}
+
+namespace
+{
+	struct Options
+	{
+		std::vector<int> shelves{ 10, 100 };
+		std::vector<int> items{ 10, 100 };
+		int frames = 300;
+		int warmup = 30;
+		bool navigate = false;
+		bool decode = false;
+		bool http_cache = false;
+		std::string connections;
+		std::string csv;
+	};
+
+	struct Counters
+	{
+		uint64_t draw_calls;
+		uint64_t texture_binds;
+		uint64_t glyph_misses;
+		uint64_t allocations;
+		uint64_t allocated_bytes;
+
+		static auto now() -> Counters
+		{
+			return { g_Renderer.GetDrawCalls(), g_Renderer.GetTextureBinds(), g_TextRenderer.GetStatistics().glyph_misses, allocation_count.load(), allocation_bytes.load() };
+		}
+	};
+
+	struct Result
+	{
+		int shelves, items;
+		std::chrono::duration<double, std::milli> build_time;
+		std::vector<double> frame_ms;
+		double draw_calls, texture_binds, glyph_misses, allocations, allocated_bytes; // per frame
+		size_t atlas_pages;
+		double atlas_fill;
+		// over build and all frames
+		double shaped_hit_rate;
+		// cost of building the content, per shelf item
+		double build_allocations;
+		// average heap memory of a shaped text
+		double shaped_text_bytes;
+	};
+
+	auto parse_list(const std::string& arg) -> std::vector<int>
+	{
+		std::vector<int> values;
+		std::stringstream stream{ arg };
+		for (std::string value; std::getline(stream, value, ',');)
+		{
+			// feeds need at least one shelf and item, e.g. navigation wraps around them
+			const auto parsed = std::stoi(value);
+			if (parsed <= 0)
+				throw std::invalid_argument("Expected a positive number, got " + value);
+			values.push_back(parsed);
+		}
+		if (values.empty())
+			throw std::invalid_argument("Expected a list of numbers, got \"" + arg + "\"");
+		return values;
+	}
+
+	auto parse_options(int argc, char* argv[]) -> Options
+	{
+		Options options;
+		for (int i = 1; i < argc; ++i)
+		{
+			auto arg = std::string{ argv[i] };
+			auto next = [&]() -> std::string {
+				if (i + 1 >= argc)
+					throw std::invalid_argument("Missing value for " + arg);
+				return argv[++i];
+			};
+
+			if (arg == "--shelves") options.shelves = parse_list(next());
+			else if (arg == "--items") options.items = parse_list(next());
+			else if (arg == "--frames") options.frames = std::stoi(next());
+			else if (arg == "--warmup") options.warmup = std::stoi(next());
+			else if (arg == "--navigate") options.navigate = true;
+			else if (arg == "--decode") options.decode = true;
+			else if (arg == "--connections") options.connections = next();
+			else if (arg == "--http-cache") options.http_cache = true;
+			else if (arg == "--csv") options.csv = next();
+			else throw std::invalid_argument("Unknown option " + arg);
+		}
+		return options;
+	}
+
+	constexpr int thumbnail_variants = 16;
+
+	auto thumbnail_url(int index)
+	{
+		return "bench://thumbnail/"s + std::to_string(index % thumbnail_variants);
+	}
+
+	// Titles mix plain Latin, accented Latin and CJK, like a real home feed
+	const std::array<std::string, 4> titles{
+		"Synthetic video number",
+		"\xc3\x87" "a co\xc3\xbbte tr\xc3\xa8s cher, \xc3\xa9pisode" /* Ça coûte très cher, épisode */,
+		"\xe6\x97\xa5\xe6\x9c\xac\xe3\x81\xae\xe9\x9f\xb3\xe6\xa5\xbd\xe3\x83\xa9\xe3\x82\xa4\xe3\x83\x96", // 日本の音楽ライブ
+		"Mixed \xe3\x83\x86\xe3\x82\xb9\xe3\x83\x88 title", // Mixed テスト title
+	};
+
+	auto synthetic_title(int shelf, int item)
+	{
+		return titles[(shelf + item) % titles.size()] + ' ' + std::to_string(shelf * 1000 + item);
+	}
+
+	auto synthetic_item(int shelf, int item) -> nlohmann::json
+	{
+		return { { "gridVideoRenderer", {
+			{ "thumbnail", { { "thumbnails", nlohmann::json::array({
+				{ { "url", thumbnail_url(shelf + item) }, { "width", 480 }, { "height", 360 } }
+			}) } } },
+			{ "navigationEndpoint", { { "watchEndpoint", { { "videoId", "bench" + std::to_string(item) } } } } },
+			{ "title", synthetic_title(shelf, item) },
+			{ "shortBylineText", "Channel " + std::to_string(item % 37) },
+			{ "shortViewCountText", std::to_string(item * 1234 % 99999) + " views" },
+			{ "lengthText", std::to_string(item % 60) + ":" + std::to_string(10 + item % 50) },
+		} } };
+	}
+
+	// Mirrors the layout of innertube's tabRenderer consumed by HomeTab
+	auto synthetic_tab(int shelves, int items) -> nlohmann::json
+	{
+		auto contents = nlohmann::json::array();
+		for (int shelf = 0; shelf < shelves; ++shelf)
+		{
+			auto shelf_items = nlohmann::json::array();
+			for (int item = 0; item < items; ++item)
+				shelf_items.push_back(synthetic_item(shelf, item));
+
+			contents.push_back({ { "shelfRenderer", {
+				{ "headerRenderer", { { "shelfHeaderRenderer", { { "title", "Shelf " + std::to_string(shelf) } } } } },
+				{ "content", { { "horizontalListRenderer", { { "items", std::move(shelf_items) } } } } },
+			} } });
+		}
+
+		return { { "tabRenderer", {
+			{ "title", "Home" },
+			{ "content", { { "tvSurfaceContentRenderer", { { "content", { { "sectionListRenderer", {
+				{ "contents", std::move(contents) },
+				{ "continuations", nlohmann::json::array({ { { "nextContinuationData", { { "continuation", "" } } } } }) },
+			} } } } } } } },
+		} } };
+	}
+
+	// Encoded as JPEGs and served in place of downloads, so the thumbnails are decoded at display size during
+	// the warmup frames and cost what downloaded ones do
+	void preload_thumbnails()
+	{
+		for (int i = 0; i < thumbnail_variants; ++i)
+		{
+			auto surface = std::unique_ptr<SDL_Surface>(SDL_CreateRGBSurfaceWithFormat(0, 480, 360, 32, SDL_PIXELFORMAT_ARGB8888));
+			for (int y = 0; y < surface->h; ++y)
+			{
+				auto row = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(surface->pixels) + y * surface->pitch);
+				for (int x = 0; x < surface->w; ++x)
+					row[x] = SDL_MapRGB(surface->format, (40 + i * 12 + x) & 0xFF, (90 + y) & 0xFF, (200 - i * 10 + x * y) & 0xFF);
+			}
+
+			// JPEG never grows much beyond the raw pixels
+			std::vector<unsigned char> encoded(static_cast<size_t>(surface->pitch) * surface->h + 64 * 1024);
+			auto writer = SDL_RWFromMem(encoded.data(), static_cast<int>(encoded.size()));
+			IMG_SaveJPG_RW(surface.get(), writer, 0, 90);
+			encoded.resize(static_cast<size_t>(SDL_RWtell(writer)));
+			SDL_RWclose(writer);
+
+			g_ImageManager.preload(utility::conversions::to_string_t(thumbnail_url(i)), std::move(encoded));
+		}
+	}
+
+	void dispatch_key(SDL_Keycode key)
+	{
+		auto event = SDL_KeyboardEvent{};
+		event.type = SDL_KEYDOWN;
+		event.keysym.sym = key;
+		for (auto it = g_KeyboardCallbacks.rbegin(); it != g_KeyboardCallbacks.rend(); ++it)
+		{
+			if (it->operator()(event))
+				break;
+		}
+	}
+
+	// Same steps as the main loop in Source.cpp, minus event handling
+	void render_frame(UI::MainMenu& main_menu)
+	{
+		g_KeyboardCallbacks.clear();
+		g_RendererQueue.execute_one(g_Renderer);
+		g_ImageManager.ProcessUploads();
+
+		g_Renderer.Clear();
+		auto dim = g_Renderer.GetSize();
+		main_menu.display({ { 0, 0 }, { dim.actual_width, dim.actual_height } });
+		g_Renderer.Present();
+
+		g_LayerCache.EndFrame();
+		g_TextureManager.EndFrame();
+	}
+
+	auto run(int shelves, int items, const Options& options) -> Result
+	{
+		auto result = Result{ .shelves = shelves, .items = items };
+
+		const auto text_start = g_TextRenderer.GetStatistics();
+
+		// Texts are built off the render thread like in the app, glyph uploads are served meanwhile
+		const auto build_counters = Counters::now();
+		auto build_start = std::chrono::steady_clock::now();
+		auto content = std::async(std::launch::async, [=] {
+			return UI::make_home_tab(synthetic_tab(shelves, items));
+		});
+		while (content.wait_for(0s) != std::future_status::ready)
+			g_RendererQueue.execute_one(g_Renderer);
+		auto main_menu = UI::MainMenu{ content.get() };
+		result.build_time = std::chrono::steady_clock::now() - build_start;
+		result.build_allocations = static_cast<double>(Counters::now().allocations - build_counters.allocations) / std::max(shelves * items, 1);
+
+		for (int frame = 0; frame < options.warmup; ++frame)
+			render_frame(main_menu);
+
+		const auto start = Counters::now();
+		for (int frame = 0; frame < options.frames; ++frame)
+		{
+			auto frame_start = std::chrono::steady_clock::now();
+			render_frame(main_menu);
+			result.frame_ms.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frame_start).count());
+
+			if (options.navigate)
+				dispatch_key(frame % items == items - 1 ? SDLK_DOWN : SDLK_RIGHT);
+		}
+		const auto end = Counters::now();
+
+		const auto frames = static_cast<double>(options.frames);
+		result.draw_calls = (end.draw_calls - start.draw_calls) / frames;
+		result.texture_binds = (end.texture_binds - start.texture_binds) / frames;
+		result.glyph_misses = (end.glyph_misses - start.glyph_misses) / frames;
+		result.allocations = (end.allocations - start.allocations) / frames;
+		result.allocated_bytes = (end.allocated_bytes - start.allocated_bytes) / frames;
+
+		const auto text_statistics = g_TextRenderer.GetStatistics();
+		result.atlas_pages = text_statistics.atlas_pages;
+		result.atlas_fill = text_statistics.atlas_fill;
+		const auto shaped_hits = text_statistics.shaped_hits - text_start.shaped_hits;
+		const auto shaped_lookups = shaped_hits + text_statistics.shaped_misses - text_start.shaped_misses;
+		result.shaped_hit_rate = shaped_lookups ? static_cast<double>(shaped_hits) / shaped_lookups : 0.;
+		result.shaped_text_bytes = text_statistics.shaped_entries ? static_cast<double>(text_statistics.shaped_bytes) / text_statistics.shaped_entries : 0.;
+
+		return result;
+	}
+
+	auto percentile(std::vector<double> values, double p)
+	{
+		if (values.empty())
+			return 0.;
+		auto nth = values.begin() + static_cast<ptrdiff_t>(p * (values.size() - 1));
+		std::nth_element(values.begin(), nth, values.end());
+		return *nth;
+	}
+
+	void report(const std::vector<Result>& results, const std::string& csv)
+	{
+		std::cout << fmt::format("{:>8} {:>6} {:>10} {:>9} {:>9} {:>9} {:>9} {:>10} {:>10} {:>10} {:>10} {:>12} {:>6} {:>6} {:>9} {:>11} {:>8}\n",
+			"shelves", "items", "build ms", "avg ms", "p50 ms", "p95 ms", "max ms", "draws", "binds", "glyph miss", "allocs", "alloc bytes", "pages", "fill", "shape hit", "allocs/item", "text B");
+
+		std::ofstream csv_file;
+		if (!csv.empty())
+		{
+			csv_file.open(csv);
+			csv_file << "shelves,items,build_ms,avg_ms,p50_ms,p95_ms,max_ms,draw_calls,texture_binds,glyph_misses,allocations,allocated_bytes,atlas_pages,atlas_fill,shaped_hit_rate,build_allocations_per_item,shaped_text_bytes\n";
+		}
+
+		for (const auto& result : results)
+		{
+			const auto avg = std::accumulate(result.frame_ms.begin(), result.frame_ms.end(), 0.) / std::max<size_t>(result.frame_ms.size(), 1);
+			const auto p50 = percentile(result.frame_ms, 0.5);
+			const auto p95 = percentile(result.frame_ms, 0.95);
+			const auto max = percentile(result.frame_ms, 1.);
+
+			std::cout << fmt::format("{:>8} {:>6} {:>10.1f} {:>9.3f} {:>9.3f} {:>9.3f} {:>9.3f} {:>10.1f} {:>10.1f} {:>10.2f} {:>10.1f} {:>12.0f} {:>6} {:>5.1f}% {:>8.1f}% {:>11.1f} {:>8.0f}\n",
+				result.shelves, result.items, result.build_time.count(), avg, p50, p95, max,
+				result.draw_calls, result.texture_binds, result.glyph_misses, result.allocations, result.allocated_bytes,
+				result.atlas_pages, result.atlas_fill * 100., result.shaped_hit_rate * 100., result.build_allocations, result.shaped_text_bytes);
+
+			if (csv_file)
+			{
+				csv_file << fmt::format("{},{},{:.3f},{:.4f},{:.4f},{:.4f},{:.4f},{:.2f},{:.2f},{:.3f},{:.2f},{:.0f},{},{:.4f},{:.4f},{:.2f},{:.0f}\n",
+					result.shelves, result.items, result.build_time.count(), avg, p50, p95, max,
+					result.draw_calls, result.texture_binds, result.glyph_misses, result.allocations, result.allocated_bytes,
+					result.atlas_pages, result.atlas_fill, result.shaped_hit_rate, result.build_allocations, result.shaped_text_bytes);
+			}
+		}
+	}
+}
+
+namespace
+{
+	// TextRenderer's decoder before decode_utf8, kept for comparison
+	std::u32string codecvt_to_u32string(const std::string& text)
+	{
+		std::u8string internal;
+		std::copy(text.begin(), text.end(), std::back_inserter(internal));
+
+		auto& f = std::use_facet<std::codecvt<char32_t, char8_t, std::mbstate_t>>(std::locale());
+		std::mbstate_t mb{};
+		std::basic_string<char32_t> external(internal.size() * f.max_length(), '\0');
+		const char8_t* from_next;
+		char32_t* to_next;
+		f.in(mb, &internal[0], &internal[internal.size()], from_next,
+			&external[0], &external[external.size()], to_next);
+		external.resize(to_next - &external[0]);
+
+		return external;
+	}
+
+	void run_decode_benchmark()
+	{
+		constexpr int count = 10000;
+		constexpr int passes = 20;
+
+		const std::array<std::pair<const char*, std::vector<size_t>>, 3> categories{ {
+			{ "latin", { 0, 1 } },
+			{ "cjk", { 2 } },
+			{ "mixed", { 3 } },
+		} };
+
+		std::cout << fmt::format("{:>8} {:>12} {:>12} {:>12} {:>12} {:>8}\n", "titles", "codecvt ns", "codecvt MB/s", "decoder ns", "decoder MB/s", "speedup");
+		for (const auto& [name, variants] : categories)
+		{
+			std::vector<std::string> samples;
+			size_t bytes = 0;
+			for (int i = 0; i < count; ++i)
+			{
+				samples.push_back(titles[variants[i % variants.size()]] + ' ' + std::to_string(i));
+				bytes += samples.back().size();
+			}
+
+			std::u32string buffer;
+			for (const auto& sample : samples)
+			{
+				decode_utf8(sample, buffer);
+				if (buffer != codecvt_to_u32string(sample))
+					std::cerr << "Decoders disagree on " << sample << '\n';
+			}
+
+			// code point totals keep the loops from being optimised away
+			auto measure = [&](auto&& decode) {
+				size_t code_points = 0;
+				const auto start = std::chrono::steady_clock::now();
+				for (int pass = 0; pass < passes; ++pass)
+				{
+					for (const auto& sample : samples)
+						code_points += decode(sample);
+				}
+				const auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+				if (code_points == 0)
+					std::cerr << "Nothing decoded\n";
+				return elapsed;
+			};
+
+			const auto codecvt_time = measure([](const std::string& sample) { return codecvt_to_u32string(sample).size(); });
+			const auto decoder_time = measure([&buffer](const std::string& sample) { decode_utf8(sample, buffer); return buffer.size(); });
+
+			const auto per_title = [](double seconds) { return seconds * 1e9 / (count * passes); };
+			const auto throughput = [bytes](double seconds) { return bytes * passes / seconds / (1024 * 1024); };
+			std::cout << fmt::format("{:>8} {:>12.1f} {:>12.1f} {:>12.1f} {:>12.1f} {:>7.1f}x\n", name,
+				per_title(codecvt_time), throughput(codecvt_time), per_title(decoder_time), throughput(decoder_time), codecvt_time / decoder_time);
+		}
+	}
+
+	void run_connection_benchmark(const std::string& url)
+	{
+		constexpr int waves = 8;
+		// above the host limit, so some requests wait for a connection to free up
+		constexpr int requests = 10;
+		constexpr auto idle_timeout = 2s;
+
+		const auto origin = utility::conversions::to_string_t(url);
+		g_ConnectionPool.SetIdleTimeout(idle_timeout);
+		g_ConnectionPool.Preconnect({ origin }).wait();
+
+		auto wave = [&] {
+			std::vector<pplx::task<void>> tasks;
+			for (int i = 0; i < requests; ++i)
+			{
+				tasks.push_back(g_ConnectionPool.Request(origin, browser_request()).then([](web::http::http_response response) {
+					return response.content_ready();
+				}).then([](pplx::task<web::http::http_response> done) {
+					try
+					{
+						done.wait();
+					}
+					catch (const std::exception& e)
+					{
+						std::cerr << "Request failed: " << e.what() << '\n';
+					}
+				}));
+			}
+			pplx::when_all(tasks.begin(), tasks.end()).wait();
+		};
+
+		for (int i = 0; i < waves; ++i)
+			wave();
+		// the host's connections expire meanwhile, so the last wave opens them again
+		std::this_thread::sleep_for(idle_timeout + 500ms);
+		wave();
+
+		const auto connections = g_ConnectionPool.GetStatistics();
+		const auto average = [](std::chrono::microseconds total, uint64_t count) { return count ? total.count() / 1000. / count : 0.; };
+		const auto requested = connections.opened + connections.reused;
+		const auto opened_ms = average(connections.opened_time, connections.opened);
+		const auto reused_ms = average(connections.reused_time, connections.reused);
+		std::cout << fmt::format("connections: {} opened, {} reused ({:.1f}% of {} requests), {} expired\n",
+			connections.opened, connections.reused, requested ? 100. * connections.reused / requested : 0., requested, connections.expired);
+		std::cout << fmt::format("response headers: {:.2f} ms avg on opened connections, {:.2f} ms avg on reused ones, handshakes ~{:.2f} ms, preconnect {:.2f} ms\n",
+			opened_ms, reused_ms, std::max(0., opened_ms - reused_ms), average(connections.preconnect_time, connections.preconnected));
+	}
+
+	// Stands in for a server. Paths name the caching headers of their response, bodies differ per url and every
+	// request carrying a validator is answered with 304 Not Modified.
+	class CannedServer
+	{
+	public:
+		static constexpr size_t body_size = 4096;
+
+		static auto body(const utility::string_t& url) -> std::vector<unsigned char>
+		{
+			const auto name = utility::conversions::to_utf8string(url);
+			std::vector<unsigned char> body(body_size);
+			for (size_t i = 0; i < body.size(); ++i)
+				body[i] = static_cast<unsigned char>(name[i % name.size()]);
+			return body;
+		}
+
+		auto fetch(const utility::string_t& url, const web::http::http_headers& headers) -> pplx::task<web::http::http_response>
+		{
+			++requests;
+			auto response = web::http::http_response{};
+			auto size = size_t{ 0 };
+			if (headers.has(web::http::header_names::if_none_match))
+			{
+				++conditional;
+				response.set_status_code(web::http::status_codes::NotModified);
+			}
+			else
+			{
+				auto content = body(url);
+				size = content.size();
+				response.set_status_code(web::http::status_codes::OK);
+				response.set_body(std::move(content));
+			}
+
+			response.headers().add(web::http::header_names::etag, U("\"1\""));
+			const auto path = utility::conversions::to_utf8string(url);
+			if (path.find("/fresh/") != std::string::npos)
+				response.headers().add(web::http::header_names::cache_control, U("max-age=3600"));
+			else if (path.find("/stale/") != std::string::npos)
+				response.headers().add(web::http::header_names::cache_control, U("max-age=0"));
+			else if (path.find("/no-cache/") != std::string::npos)
+				response.headers().add(web::http::header_names::cache_control, U("no-cache"));
+			else if (path.find("/no-store/") != std::string::npos)
+				response.headers().add(web::http::header_names::cache_control, U("no-store"));
+
+			// only http_client marks a body as received, readers of a response built here would wait forever
+			response._get_impl()->_complete(size);
+			return pplx::task_from_result(response);
+		}
+
+		std::atomic<int> requests{ 0 };
+		std::atomic<int> conditional{ 0 };
+	};
+
+	auto run_http_cache_check() -> int
+	{
+		const auto directory = std::filesystem::temp_directory_path() / "YouTubeTVBenchmark-http-cache";
+		std::error_code error;
+		std::filesystem::remove_all(directory, error);
+
+		CannedServer server;
+		auto make_cache = [&] {
+			auto cache = std::make_unique<HttpCache>(directory, [&server](const utility::string_t& url, const web::http::http_headers& headers, pplx::cancellation_token) {
+				return server.fetch(url, headers);
+			});
+			cache->Load();
+			return cache;
+		};
+		auto cache = make_cache();
+
+		auto failures = 0;
+		auto check = [&failures](const char* name, bool passed) {
+			std::cout << fmt::format("{:<48} {}\n", name, passed ? "ok" : "FAILED");
+			failures += !passed;
+		};
+		// requests made by `get` and statistics after it
+		auto get = [&](const utility::string_t& url, HttpCache::progress_t progress = {}) {
+			const auto before = server.requests.load();
+			const auto body = cache->get(url, pplx::cancellation_token::none(), std::move(progress)).get();
+			return std::tuple{ body == CannedServer::body(url), server.requests - before, cache->GetStatistics() };
+		};
+		// revalidations of stale entries run in the background
+		auto wait_for_not_modified = [&](uint64_t count) {
+			for (auto waited = 0ms; cache->GetStatistics().not_modified < count && waited < 5s; waited += 10ms)
+				std::this_thread::sleep_for(10ms);
+			return cache->GetStatistics().not_modified >= count;
+		};
+
+		{
+			const auto url = U("http://canned/fresh/a");
+			const auto [downloaded, downloads, first] = get(url);
+			const auto [cached, requests, second] = get(url);
+			check("fresh: downloaded once", downloaded && downloads == 1);
+			check("fresh: served from disk without a request", cached && requests == 0 && second.fresh_hits == first.fresh_hits + 1);
+		}
+
+		{
+			const auto url = U("http://canned/stale/a");
+			get(url);
+			const auto before = cache->GetStatistics();
+			const auto [cached, requests, after] = get(url);
+			check("stale: served from disk", cached && after.stale_hits == before.stale_hits + 1);
+			check("stale: revalidated with 304 in the background", wait_for_not_modified(before.not_modified + 1));
+		}
+
+		{
+			const auto url = U("http://canned/no-cache/a");
+			get(url);
+			const auto before = cache->GetStatistics();
+			const auto conditional = server.conditional.load();
+			const auto [cached, requests, after] = get(url);
+			check("no-cache: revalidated before use", cached && requests == 1 && server.conditional == conditional + 1);
+			check("no-cache: 304 served from disk", after.not_modified == before.not_modified + 1
+				&& after.fresh_hits == before.fresh_hits && after.stale_hits == before.stale_hits);
+		}
+
+		{
+			const auto url = U("http://canned/no-store/a");
+			const auto entries = cache->GetStatistics().entries;
+			get(url);
+			const auto [downloaded, requests, after] = get(url);
+			check("no-store: never kept", downloaded && requests == 1 && after.entries == entries);
+		}
+
+		{
+			auto reported = size_t{ 0 };
+			const auto [downloaded, requests, after] = get(U("http://canned/fresh/progress"), [&reported](std::span<const unsigned char> received) {
+				reported = received.size();
+			});
+			check("progress: sees the whole body", downloaded && reported == CannedServer::body_size);
+		}
+
+		{
+			cache->Save();
+			cache = make_cache();
+			const auto [cached, requests, after] = get(U("http://canned/fresh/a"));
+			check("index: entries survive a reload", cached && requests == 0 && after.fresh_hits == 1);
+		}
+
+		{
+			// room for two bodies, the least recently used ones go
+			const auto before = cache->GetStatistics();
+			for (auto url : { U("http://canned/fresh/b"), U("http://canned/fresh/c"), U("http://canned/fresh/d") })
+				get(url);
+			cache->SetBudget(2 * CannedServer::body_size);
+			const auto after = cache->GetStatistics();
+			check("trim: evicts down to the budget", after.evictions > before.evictions && after.bytes <= after.budget && after.entries <= 2);
+			const auto [downloaded, requests, statistics] = get(U("http://canned/fresh/a"));
+			check("trim: evicted urls are downloaded again", downloaded && requests == 1);
+		}
+
+		cache.reset();
+		std::filesystem::remove_all(directory, error);
+		std::cout << fmt::format("http cache: {} checks failed\n", failures);
+		return failures ? 1 : 0;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	try
+	{
+		options = parse_options(argc, argv);
+	}
+	catch (const std::exception& error)
+	{
+		std::cerr << error.what() << '\n';
+		return 1;
+	}
+
+	if (options.decode)
+	{
+		run_decode_benchmark();
+		return 0;
+	}
+
+	if (!options.connections.empty())
+	{
+		run_connection_benchmark(options.connections);
+		return 0;
+	}
+
+	if (options.http_cache)
+		return run_http_cache_check();
+
+	spdlog::set_level(spdlog::level::warn);
+
+	YouTube::YouTubeCoreRAII yt_core{ true };
+	g_RendererQueue.execute_one(g_Renderer);
+	preload_thumbnails();
+
+	std::vector<Result> results;
+	for (auto shelves : options.shelves)
+	{
+		for (auto items : options.items)
+		{
+			results.push_back(run(shelves, items, options));
+			g_LayerCache.Clear();
+		}
+	}
+
+	report(results, options.csv);
+
+	const auto fonts = g_FontManager.GetStatistics();
+	std::cout << fmt::format("fonts: {} sizes over {} mapped files, {:.1f} MiB mapped, {:.1f} MiB resident\n",
+		fonts.fonts, fonts.files, fonts.mapped_bytes / (1024. * 1024.), fonts.resident_bytes / (1024. * 1024.));
+
+	const auto images = g_ImageManager.GetStatistics();
+	const auto average = [](std::chrono::microseconds total, size_t count) { return count ? total.count() / 1000. / count : 0.; };
+	std::cout << fmt::format("images: {} decoded, {} failed, {} uploaded ({:.1f} MiB), decode {:.2f} ms avg {:.2f} ms max, upload {:.2f} ms avg {:.2f} ms max\n",
+		images.decoded, images.failed, images.uploaded, images.uploaded_bytes / (1024. * 1024.),
+		average(images.decode_time, images.decoded + images.failed), images.max_decode.count() / 1000.,
+		average(images.upload_time, images.uploaded), images.max_upload.count() / 1000.);
+	std::cout << fmt::format("image cache: {} images, {:.1f} of {:.1f} MiB, {} hits, {} misses, {} evictions\n",
+		images.cached_images, images.cached_bytes / (1024. * 1024.), images.budget / (1024. * 1024.), images.hits, images.misses, images.evictions);
+	const auto saved = images.cached_full_bytes ? 100. * (images.cached_full_bytes - images.cached_bytes) / images.cached_full_bytes : 0.;
+	std::cout << fmt::format("thumbnails: {:.1f} MiB at display size instead of {:.1f} MiB, {:.0f}% saved\n",
+		images.cached_bytes / (1024. * 1024.), images.cached_full_bytes / (1024. * 1024.), saved);
+	std::cout << fmt::format("thumbnail atlas: {} pages ({:.1f} MiB), {} of {} slots used, {:.1f}% occupancy, {:.1f}% fragmentation, {} of {} allocations reused\n",
+		images.atlas.pages, images.atlas.page_bytes / (1024. * 1024.), images.atlas.used_slots, images.atlas.slots,
+		images.atlas.occupancy * 100., images.atlas.fragmentation * 100., images.atlas.reuses, images.atlas.allocations);
+	// preloaded sources arrive whole, so previews only show up for images downloaded through the cache
+	std::cout << fmt::format("image loads: first pixel {:.2f} ms avg, complete {:.2f} ms avg, {} previews\n",
+		average(images.first_pixel_time, images.timed_loads), average(images.complete_time, images.timed_loads), images.previews);
+	g_ImageManager.clear();
+
+	return 0;
+}
@@ -0,0 +1,237 @@
+#include "pch.h"
+
+#include "ConnectionPool.h"
+
+#include <algorithm>
+
+using std::chrono::duration_cast, std::chrono::microseconds;
+
+auto ConnectionPool::Request(const utility::string_t& origin, web::http::http_request request, pplx::cancellation_token token)
+	-> pplx::task<web::http::http_response>
+{
+	return enqueue(origin, std::move(request), token, false);
+}
+
+auto ConnectionPool::Preconnect(const std::vector<utility::string_t>& origins) -> pplx::task<void>
+{
+	std::vector<pplx::task<void>> connecting;
+	for (const auto& origin : origins)
+	{
+		// HEAD has no body to wait for, so the connection is idle as soon as it's answered
+		auto request = web::http::http_request{ web::http::methods::HEAD };
+		request.set_request_uri(U("/"));
+		connecting.push_back(enqueue(origin, std::move(request), pplx::cancellation_token::none(), true).then([origin](pplx::task<web::http::http_response> done) {
+			try
+			{
+				done.wait();
+			}
+			catch (const std::exception& e)
+			{
+				spdlog::warn("ConnectionPool: could not preconnect to {}: {}", utility::conversions::to_utf8string(origin), e.what());
+			}
+		}));
+	}
+	return pplx::when_all(connecting.begin(), connecting.end());
+}
+
+void ConnectionPool::SetHostLimit(size_t connections)
+{
+	std::vector<std::pair<utility::string_t, Waiter>> starting;
+	{
+		std::scoped_lock lc{ mtx };
+		host_limit = std::max<size_t>(connections, 1);
+		for (auto& [origin, host] : hosts)
+		{
+			while (host.busy < host_limit && !host.queue.empty())
+			{
+				starting.emplace_back(origin, std::move(host.queue.front()));
+				host.queue.erase(host.queue.begin());
+				++host.busy;
+			}
+		}
+	}
+
+	for (auto& [origin, waiter] : starting)
+		start(origin, std::move(waiter));
+}
+
+void ConnectionPool::SetIdleTimeout(std::chrono::steady_clock::duration timeout)
+{
+	std::scoped_lock lc{ mtx };
+	idle_timeout = timeout;
+}
+
+auto ConnectionPool::GetStatistics() -> Statistics
+{
+	std::scoped_lock lc{ mtx };
+	expire(std::chrono::steady_clock::now());
+
+	auto result = statistics;
+	for (const auto& [origin, host] : hosts)
+	{
+		if (host.client)
+			++result.hosts;
+		result.idle += host.idle;
+		result.busy += host.busy;
+		result.queued += host.queue.size();
+	}
+	return result;
+}
+
+auto ConnectionPool::enqueue(const utility::string_t& origin, web::http::http_request request, pplx::cancellation_token token, bool preconnect)
+	-> pplx::task<web::http::http_response>
+{
+	auto waiter = Waiter{ 0, std::move(request), token, {}, preconnect };
+	// cancelling the token cancels the task even while the request is still waiting
+	auto response = pplx::task<web::http::http_response>(waiter.response, token);
+
+	auto starting = false;
+	{
+		std::scoped_lock lc{ mtx };
+		expire(std::chrono::steady_clock::now());
+		waiter.id = ++next_id;
+		auto& host = hosts[origin];
+		if (host.busy < host_limit)
+		{
+			++host.busy;
+			starting = true;
+		}
+		else
+		{
+			host.queue.push_back(waiter);
+		}
+	}
+
+	if (starting)
+		start(origin, std::move(waiter));
+	// runs right away when the token is cancelled already, so it can't be registered under the lock
+	else if (token.is_cancelable())
+		token.register_callback([this, origin, id = waiter.id] { cancel(origin, id); });
+
+	return response;
+}
+
+void ConnectionPool::start(const utility::string_t& origin, Waiter waiter)
+{
+	std::optional<web::http::client::http_client> client;
+	auto reused = false;
+	try
+	{
+		std::scoped_lock lc{ mtx };
+		auto& host = hosts[origin];
+		if (!host.client)
+			host.client.emplace(origin);
+		client = host.client;
+
+		reused = host.idle > 0;
+		if (reused)
+		{
+			--host.idle;
+			++statistics.reused;
+		}
+		else
+		{
+			++statistics.opened;
+		}
+	}
+	catch (...)
+	{
+		// not a valid origin
+		waiter.response.set_exception(std::current_exception());
+		release(origin, false);
+		return;
+	}
+
+	const auto sent = std::chrono::steady_clock::now();
+	client->request(waiter.request, waiter.token).then([this, origin, waiter, reused, sent](pplx::task<web::http::http_response> done) {
+		try
+		{
+			auto response = done.get();
+			const auto elapsed = duration_cast<microseconds>(std::chrono::steady_clock::now() - sent);
+			{
+				std::scoped_lock lc{ mtx };
+				(reused ? statistics.reused_time : statistics.opened_time) += elapsed;
+				if (waiter.preconnect)
+				{
+					++statistics.preconnected;
+					statistics.preconnect_time += elapsed;
+				}
+			}
+
+			// HTTP/1.1 keeps connections open unless either side asks otherwise
+			auto connection = utility::string_t{};
+			const auto reusable = !response.headers().match(web::http::header_names::connection, connection)
+				|| !utility::details::str_iequal(connection, U("close"));
+			waiter.response.set(response);
+
+			// the connection takes the next request once the body has been read off it
+			response.content_ready().then([this, origin, reusable](pplx::task<web::http::http_response> body) {
+				try
+				{
+					body.wait();
+					release(origin, reusable);
+				}
+				catch (...)
+				{
+					release(origin, false);
+				}
+			});
+		}
+		catch (...)
+		{
+			// failed or aborted, the connection may be gone with it
+			waiter.response.set_exception(std::current_exception());
+			release(origin, false);
+		}
+	});
+}
+
+void ConnectionPool::release(const utility::string_t& origin, bool reusable)
+{
+	std::optional<Waiter> next;
+	{
+		std::scoped_lock lc{ mtx };
+		auto& host = hosts[origin];
+		host.last_used = std::chrono::steady_clock::now();
+		if (reusable)
+			++host.idle;
+
+		// cancelled waiters were dropped by cancel, the first one is still wanted. Above a lowered limit the
+		// connection isn't passed on.
+		if (!host.queue.empty() && host.busy <= host_limit)
+		{
+			next = std::move(host.queue.front());
+			host.queue.erase(host.queue.begin());
+		}
+		else
+		{
+			--host.busy;
+		}
+	}
+
+	if (next)
+		start(origin, std::move(*next));
+}
+
+void ConnectionPool::cancel(const utility::string_t& origin, uint64_t id)
+{
+	std::scoped_lock lc{ mtx };
+	auto& queue = hosts[origin].queue;
+	// requests in flight are aborted by the token itself
+	if (auto it = std::find_if(queue.begin(), queue.end(), [id](const Waiter& waiter) { return waiter.id == id; }); it != queue.end())
+		queue.erase(it);
+}
+
+void ConnectionPool::expire(std::chrono::steady_clock::time_point now)
+{
+	for (auto& [origin, host] : hosts)
+	{
+		if (host.client && host.busy == 0 && now - host.last_used > idle_timeout)
+		{
+			// destroying the client closes the connections it kept alive
+			statistics.expired += host.idle;
+			host.idle = 0;
+			host.client.reset();
+		}
+	}
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <optional>
+#include <chrono>
+#include <mutex>
+#include <cstdint>
+
+#include <cpprest/http_client.h>
+
+// One http_client per origin, shared by everything that talks to it, so kept-alive connections are reused across
+// callers. Requests beyond the host limit wait for a connection to free up, in the order they were made. A host left
+// idle longer than the idle timeout drops its client and with it the connections it kept open.
+//
+// cpprest doesn't report connection events, so connections are counted from the requests: each request holds one
+// until its body has arrived, after which it's idle unless the server asked to close it. This matches the client as
+// long as every request to the origin goes through the pool.
+class ConnectionPool
+{
+public:
+	struct Statistics
+	{
+		size_t hosts;
+		size_t idle;
+		size_t busy;
+		size_t queued;
+		// requests that had to open a connection
+		uint64_t opened;
+		// requests served by a connection left idle by an earlier one
+		uint64_t reused;
+		// idle connections dropped with their host's client
+		uint64_t expired;
+		uint64_t preconnected;
+		// until the response headers arrived, on opened and on reused connections. The difference is what DNS,
+		// TCP and TLS handshakes cost.
+		std::chrono::microseconds opened_time;
+		std::chrono::microseconds reused_time;
+		// of the requests made by Preconnect, which do little more than handshake
+		std::chrono::microseconds preconnect_time;
+	};
+
+	static constexpr size_t default_host_limit = 6;
+	static constexpr std::chrono::seconds default_idle_timeout{ 30 };
+
+public:
+	// `origin` is scheme, host and optionally port, e.g. https://i.ytimg.com. The token aborts the request, or drops
+	// it while it's waiting for a connection.
+	auto Request(const utility::string_t& origin, web::http::http_request request, pplx::cancellation_token token = pplx::cancellation_token::none())
+		-> pplx::task<web::http::http_response>;
+
+	// Opens a connection to each origin in the background, so the first real request doesn't pay for the handshakes.
+	// Completes once every origin answered or failed, failures are only logged.
+	auto Preconnect(const std::vector<utility::string_t>& origins) -> pplx::task<void>;
+
+	void SetHostLimit(size_t connections);
+	void SetIdleTimeout(std::chrono::steady_clock::duration timeout);
+	auto GetStatistics() -> Statistics;
+
+private:
+	struct Waiter
+	{
+		uint64_t id;
+		web::http::http_request request;
+		pplx::cancellation_token token;
+		pplx::task_completion_event<web::http::http_response> response;
+		bool preconnect;
+	};
+
+	struct Host
+	{
+		std::optional<web::http::client::http_client> client;
+		std::vector<Waiter> queue;
+		size_t busy = 0;
+		size_t idle = 0;
+		std::chrono::steady_clock::time_point last_used;
+	};
+
+private:
+	auto enqueue(const utility::string_t& origin, web::http::http_request request, pplx::cancellation_token token, bool preconnect)
+		-> pplx::task<web::http::http_response>;
+	// Sends a request that has been given a connection
+	void start(const utility::string_t& origin, Waiter waiter);
+	// The connection is idle again, or closed when `reusable` is false. Hands it to the next waiter.
+	void release(const utility::string_t& origin, bool reusable);
+	void cancel(const utility::string_t& origin, uint64_t id);
+
+	// Helpers below expect mtx to be held
+	void expire(std::chrono::steady_clock::time_point now);
+
+private:
+	std::mutex mtx;
+	std::unordered_map<utility::string_t, Host> hosts;
+	size_t host_limit = default_host_limit;
+	std::chrono::steady_clock::duration idle_timeout = default_idle_timeout;
+	uint64_t next_id = 0;
+	Statistics statistics{};
+};
@@ -10,6 +10,9 @@ extern "C" {
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_ttf.h>
 
+// Defined by TextureManager, keeps texture accounting in sync with every destroyed texture
+void unregister_texture(SDL_Texture* texture) noexcept;
+
 struct CustomAVIO
 {
 	virtual ~CustomAVIO() = default;
@@ -49,6 +52,7 @@ namespace std
 	template<> struct default_delete<SDL_Texture> {
 		void operator()(SDL_Texture* ptr)
 		{
+			unregister_texture(ptr);
 			SDL_DestroyTexture(ptr);
 		}
 	};
@@ -0,0 +1,138 @@
+#include "pch.h"
+
+#include "FetchScheduler.h"
+
+#include <algorithm>
+#include <tuple>
+
+auto FetchScheduler::schedule(const utility::string_t& host, const utility::string_t& key, int priority, pplx::cancellation_token token, request_t request)
+	-> pplx::task<web::http::http_response>
+{
+	auto job = Job{ 0, key, priority, token, std::move(request), {} };
+	// cancelling the token cancels the task even while the request is still queued
+	auto response = pplx::task<web::http::http_response>(job.response, token);
+	{
+		std::scoped_lock lc{ mtx };
+		job.id = ++next_id;
+		hosts[host].queue.push_back(job);
+	}
+
+	// runs right away when the token is cancelled already, so it can't be registered under the lock
+	if (token.is_cancelable())
+		token.register_callback([this, host, id = job.id] { cancel(host, id); });
+
+	dispatch(host);
+	return response;
+}
+
+void FetchScheduler::Prioritize(const utility::string_t& key, int priority)
+{
+	std::scoped_lock lc{ mtx };
+	for (auto& [name, host] : hosts)
+	{
+		for (auto& job : host.queue)
+		{
+			if (job.key == key && job.priority != priority)
+			{
+				job.priority = priority;
+				++statistics.reprioritized;
+			}
+		}
+	}
+}
+
+void FetchScheduler::SetHostLimit(size_t requests)
+{
+	std::vector<utility::string_t> names;
+	{
+		std::scoped_lock lc{ mtx };
+		host_limit = std::max<size_t>(requests, 1);
+		for (const auto& [name, host] : hosts)
+			names.push_back(name);
+	}
+
+	for (const auto& name : names)
+		dispatch(name);
+}
+
+auto FetchScheduler::GetStatistics() const -> Statistics
+{
+	std::scoped_lock lc{ mtx };
+	auto result = statistics;
+	for (const auto& [name, host] : hosts)
+	{
+		result.queued += host.queue.size();
+		result.running += host.running;
+	}
+	return result;
+}
+
+void FetchScheduler::dispatch(const utility::string_t& host_name)
+{
+	std::vector<Job> starting;
+	{
+		std::scoped_lock lc{ mtx };
+		auto& host = hosts[host_name];
+		while (host.running < host_limit && !host.queue.empty())
+		{
+			// queues stay short, a scan is cheaper than keeping a heap ordered while priorities change
+			auto next = std::min_element(host.queue.begin(), host.queue.end(), [](const Job& lhs, const Job& rhs) {
+				return std::tie(lhs.priority, lhs.id) < std::tie(rhs.priority, rhs.id);
+			});
+			starting.push_back(std::move(*next));
+			host.queue.erase(next);
+			++host.running;
+			++statistics.started;
+		}
+	}
+
+	for (auto& job : starting)
+	{
+		job.request(job.token).then([this, host_name, response = job.response](pplx::task<web::http::http_response> done) {
+			try
+			{
+				auto headers = done.get();
+				response.set(headers);
+				// the connection stays taken until the body is in, freeing the slot at the headers would only move
+				// the next request into the connection pool's queue, where priorities no longer apply
+				headers.content_ready().then([this, host_name](pplx::task<web::http::http_response> body) {
+					try
+					{
+						body.wait();
+					}
+					catch (...)
+					{
+						// observed here, the reader of the body gets the error as well
+					}
+					finish(host_name);
+				});
+			}
+			catch (...)
+			{
+				response.set_exception(std::current_exception());
+				finish(host_name);
+			}
+		});
+	}
+}
+
+void FetchScheduler::finish(const utility::string_t& host_name)
+{
+	{
+		std::scoped_lock lc{ mtx };
+		--hosts[host_name].running;
+	}
+	dispatch(host_name);
+}
+
+void FetchScheduler::cancel(const utility::string_t& host_name, uint64_t id)
+{
+	std::scoped_lock lc{ mtx };
+	auto& queue = hosts[host_name].queue;
+	// requests in flight are aborted by the token itself
+	if (auto it = std::find_if(queue.begin(), queue.end(), [id](const Job& job) { return job.id == id; }); it != queue.end())
+	{
+		queue.erase(it);
+		++statistics.cancelled;
+	}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <cstdint>
+
+#include <cpprest/http_client.h>
+
+// Starts requests in priority order with a bounded number in flight per host. Lower values go first. A request is in
+// flight until its body has arrived, like it holds its connection in g_ConnectionPool.
+// Cancelling a request's token drops it from the queue, or aborts it once it's in flight.
+class FetchScheduler
+{
+public:
+	// Sends the request, passing the token on to http_client::request
+	using request_t = std::function<pplx::task<web::http::http_response>(pplx::cancellation_token token)>;
+
+	// for requests nobody is waiting for, e.g. revalidations
+	static constexpr int background = std::numeric_limits<int>::max();
+	static constexpr size_t default_host_limit = 6;
+
+	struct Statistics
+	{
+		uint64_t started;
+		uint64_t cancelled;
+		uint64_t reprioritized;
+		size_t queued;
+		size_t running;
+	};
+
+public:
+	auto schedule(const utility::string_t& host, const utility::string_t& key, int priority, pplx::cancellation_token token, request_t request)
+		-> pplx::task<web::http::http_response>;
+	// Moves queued requests for `key` to another priority
+	void Prioritize(const utility::string_t& key, int priority);
+
+	void SetHostLimit(size_t requests);
+	auto GetStatistics() const -> Statistics;
+
+private:
+	struct Job
+	{
+		uint64_t id;
+		utility::string_t key;
+		int priority;
+		pplx::cancellation_token token;
+		request_t request;
+		pplx::task_completion_event<web::http::http_response> response;
+	};
+
+	struct Host
+	{
+		std::vector<Job> queue;
+		size_t running = 0;
+	};
+
+private:
+	// Starts queued requests of the host while it has free slots
+	void dispatch(const utility::string_t& host);
+	// A request is done with its slot
+	void finish(const utility::string_t& host);
+	void cancel(const utility::string_t& host, uint64_t id);
+
+private:
+	mutable std::mutex mtx;
+	std::unordered_map<utility::string_t, Host> hosts;
+	size_t host_limit = default_host_limit;
+	uint64_t next_id = 0;
+	Statistics statistics{};
+};
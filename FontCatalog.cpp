@@ -0,0 +1,327 @@
+#include "pch.h"
+
+#include "FontCatalog.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <cctype>
+#include <iterator>
+
+#include <cpprest/asyncrt_utils.h>
+#include <nlohmann/json.hpp>
+#include <utf8cpp/utf8.h>
+
+#include "MappedFile.h"
+#include "OpenType.h"
+
+namespace
+{
+	auto modification_time(const std::filesystem::path& path) -> int64_t
+	{
+		std::error_code error;
+		auto time = std::filesystem::last_write_time(path, error);
+		return error ? -1 : static_cast<int64_t>(time.time_since_epoch().count());
+	}
+
+	auto to_utf8(const std::filesystem::path& path) -> std::string
+	{
+		return utility::conversions::to_utf8string(path.native());
+	}
+
+	auto from_utf8(const std::string& path) -> std::filesystem::path
+	{
+		return utility::conversions::to_string_t(path);
+	}
+
+	// Record `name_id` of a name table in UTF-8, empty when there is none. English Windows records are preferred,
+	// like FreeType does, so names match what SDL_ttf reports.
+	auto read_name(std::span<const std::byte> table, uint32_t name_id) -> std::string
+	{
+		using OpenType::read_u16;
+
+		int windows = -1, english = -1, unicode = -1, mac = -1;
+		const auto records = read_u16(table, 2);
+		for (uint32_t i = 0; i < records; ++i)
+		{
+			const auto record = 6 + 12 * static_cast<size_t>(i);
+			if (read_u16(table, record + 6) != name_id || read_u16(table, record + 8) == 0)
+				continue;
+
+			const auto platform = read_u16(table, record), encoding = read_u16(table, record + 2), language = read_u16(table, record + 4);
+			const auto index = static_cast<int>(i);
+			if (platform == 0 && unicode < 0)
+				unicode = index;
+			else if (platform == 1 && encoding == 0 && language == 0 && mac < 0)
+				mac = index;
+			else if (platform == 3 && (encoding == 0 || encoding == 1 || encoding == 10))
+			{
+				if (windows < 0)
+					windows = index;
+				if (english < 0 && (language & 0x3FF) == 0x009)
+					english = index;
+			}
+		}
+
+		const auto chosen = english >= 0 ? english : windows >= 0 ? windows : unicode >= 0 ? unicode : mac;
+		if (chosen < 0)
+			return {};
+
+		const auto record = 6 + 12 * static_cast<size_t>(chosen);
+		const size_t length = read_u16(table, record + 8), offset = read_u16(table, 4) + read_u16(table, record + 10);
+		if (offset > table.size() || length > table.size() - offset)
+			return {};
+		const auto bytes = table.subspan(offset, length);
+
+		std::string name;
+		if (chosen == mac)
+		{
+			// Mac Roman, only its ASCII half is taken as is
+			for (auto byte : bytes)
+				name += static_cast<unsigned char>(byte) < 0x80 ? static_cast<char>(byte) : '?';
+			return name;
+		}
+
+		// the others are UTF-16BE
+		std::u16string units;
+		for (size_t i = 0; i + 1 < bytes.size(); i += 2)
+			units += static_cast<char16_t>(read_u16(bytes, i));
+		try
+		{
+			utf8::utf16to8(units.begin(), units.end(), std::back_inserter(name));
+		}
+		catch (const utf8::exception&)
+		{
+			return {};
+		}
+		return name;
+	}
+
+	// "Family Style" of the face, picking the same name records as FreeType
+	auto read_face_name(std::span<const std::byte> file, uint32_t face) -> std::string
+	{
+		const auto names = OpenType::find_table(file, face, OpenType::tag("name"));
+		if (names.empty())
+			return {};
+
+		// fsSelection bit 8: the typographic names already follow the weight/width/slope model
+		const auto os2 = OpenType::find_table(file, face, OpenType::tag("OS/2"));
+		const auto wws = os2.size() >= 64 && (OpenType::read_u16(os2, 62) & 0x100);
+
+		auto first_of = [&](std::initializer_list<uint32_t> ids) {
+			for (auto id : ids)
+			{
+				if (auto name = read_name(names, id); !name.empty())
+					return name;
+			}
+			return std::string{};
+		};
+		const auto family = wws ? first_of({ 16, 1 }) : first_of({ 21, 16, 1 });
+		const auto style = wws ? first_of({ 17, 2 }) : first_of({ 22, 17, 2 });
+		if (family.empty() || style.empty())
+			return {};
+		return family + ' ' + style;
+	}
+}
+
+bool FontCatalog::Load()
+{
+	std::ifstream in(catalog_path, std::ios::binary);
+	if (!in)
+		return false;
+
+	try
+	{
+		const auto catalog = nlohmann::json::parse(in);
+		if (catalog.at("version").get<uint32_t>() != version)
+			return false;
+
+		for (const auto& root : catalog.at("roots"))
+			roots.push_back(from_utf8(root.get<std::string>()));
+
+		for (const auto& directory : catalog.at("directories"))
+			directories.emplace(from_utf8(directory.at("path").get<std::string>()).native(), directory.at("modified").get<int64_t>());
+
+		for (const auto& file : catalog.at("files"))
+		{
+			auto entry = File{ file.at("size").get<uintmax_t>(), file.at("root").get<size_t>(), {} };
+			for (const auto& face : file.at("faces"))
+				entry.faces.emplace_back(face.at("name").get<std::string>(), face.at("index").get<long>());
+			files.emplace(from_utf8(file.at("path").get<std::string>()).native(), std::move(entry));
+		}
+	}
+	catch (const nlohmann::json::exception& error)
+	{
+		spdlog::warn("FontCatalog: {} is corrupted: {}", catalog_path.string(), error.what());
+		roots.clear();
+		directories.clear();
+		files.clear();
+		return false;
+	}
+
+	return true;
+}
+
+void FontCatalog::Save() const
+{
+	auto catalog = nlohmann::json{
+		{ "version", version },
+		{ "roots", nlohmann::json::array() },
+		{ "directories", nlohmann::json::array() },
+		{ "files", nlohmann::json::array() },
+	};
+
+	for (const auto& root : roots)
+		catalog["roots"].push_back(to_utf8(root));
+
+	for (const auto& [directory, modified] : directories)
+		catalog["directories"].push_back({ { "path", to_utf8(directory) }, { "modified", modified } });
+
+	for (const auto& [path, file] : files)
+	{
+		auto faces = nlohmann::json::array();
+		for (const auto& [name, index] : file.faces)
+			faces.push_back({ { "name", name }, { "index", index } });
+		catalog["files"].push_back({ { "path", to_utf8(path) }, { "size", file.size }, { "root", file.root }, { "faces", std::move(faces) } });
+	}
+
+	std::error_code error;
+	if (catalog_path.has_parent_path())
+		std::filesystem::create_directories(catalog_path.parent_path(), error);
+
+	auto temporary = catalog_path;
+	temporary += ".tmp";
+	{
+		std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+		out << catalog.dump(1, '\t');
+		if (!out)
+		{
+			spdlog::warn("FontCatalog: could not write {}", temporary.string());
+			return;
+		}
+	}
+
+	std::filesystem::rename(temporary, catalog_path, error);
+	if (error)
+		spdlog::warn("FontCatalog: could not replace {}: {}", catalog_path.string(), error.message());
+}
+
+bool FontCatalog::IsCurrent(const std::vector<std::filesystem::path>& scanned_roots) const
+{
+	if (scanned_roots != roots)
+		return false;
+
+	// adding or removing a file changes its directory, replacing one in place almost always changes its size
+	for (const auto& [directory, modified] : directories)
+	{
+		if (modification_time(directory) != modified)
+			return false;
+	}
+
+	for (const auto& [path, file] : files)
+	{
+		std::error_code error;
+		if (std::filesystem::file_size(path, error) != file.size || error)
+			return false;
+	}
+
+	// a root that didn't exist during the last scan may have been created since
+	return std::all_of(roots.begin(), roots.end(), [this](const std::filesystem::path& root) {
+		std::error_code error;
+		return directories.contains(root.native()) || !std::filesystem::is_directory(root, error);
+	});
+}
+
+void FontCatalog::Refresh(const std::vector<std::filesystem::path>& scanned_roots)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	decltype(directories) seen_directories;
+	decltype(files) seen_files;
+	size_t opened = 0;
+	for (size_t root = 0; root < scanned_roots.size(); ++root)
+	{
+		const auto& directory = scanned_roots[root];
+
+		std::error_code error;
+		if (!std::filesystem::is_directory(directory, error))
+		{
+			spdlog::debug("FontCatalog: {} does not exist. Skipping.", directory.string());
+			continue;
+		}
+
+		seen_directories.emplace(directory.native(), modification_time(directory));
+		auto it = std::filesystem::recursive_directory_iterator(directory, std::filesystem::directory_options::skip_permission_denied, error);
+		for (; !error && it != std::filesystem::recursive_directory_iterator{}; it.increment(error))
+		{
+			// failing entries are skipped, only failing iteration ends the walk
+			std::error_code entry_error;
+			const auto& path = it->path();
+			if (it->is_directory(entry_error))
+			{
+				seen_directories.emplace(path.native(), modification_time(path));
+				continue;
+			}
+
+			auto extension = path.extension().string();
+			std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+			if (std::find(supported_extensions.begin(), supported_extensions.end(), extension) == supported_extensions.end())
+				continue;
+
+			const auto size = it->file_size(entry_error);
+			if (entry_error || seen_files.contains(path.native()))
+				continue;
+
+			// unchanged files keep their names, only new ones are opened
+			if (auto known = files.find(path.native()); known != files.end() && known->second.size == size)
+			{
+				seen_files.emplace(path.native(), File{ size, root, known->second.faces });
+				continue;
+			}
+
+			seen_files.emplace(path.native(), File{ size, root, read_faces(path) });
+			++opened;
+		}
+	}
+
+	roots = scanned_roots;
+	directories = std::move(seen_directories);
+	files = std::move(seen_files);
+
+	spdlog::info("FontCatalog: {} font files in {} directories, {} opened, in {} ms", files.size(), directories.size(), opened,
+		std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+auto FontCatalog::faces() const -> std::unordered_map<std::string, Face>
+{
+	std::unordered_map<std::string, std::pair<Face, size_t>> ranked;
+	for (const auto& [path, file] : files)
+	{
+		for (const auto& [name, index] : file.faces)
+		{
+			auto [it, inserted] = ranked.try_emplace(name, Face{ path, index }, file.root);
+			if (!inserted && file.root < it->second.second)
+				it->second = { Face{ path, index }, file.root };
+		}
+	}
+
+	std::unordered_map<std::string, Face> faces;
+	for (auto& [name, face] : ranked)
+		faces.emplace(name, std::move(face.first));
+	return faces;
+}
+
+auto FontCatalog::read_faces(const std::filesystem::path& path) -> std::vector<std::pair<std::string, long>>
+{
+	std::vector<std::pair<std::string, long>> faces;
+
+	const auto file = MappedFile{ path };
+	const auto count = OpenType::face_count(file.bytes());
+	for (uint32_t index = 0; index < count; ++index)
+	{
+		if (auto name = read_face_name(file.bytes(), index); !name.empty())
+			faces.emplace_back(std::move(name), static_cast<long>(index));
+	}
+
+	return faces;
+}
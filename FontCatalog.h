@@ -0,0 +1,58 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <filesystem>
+#include <cstdint>
+
+// Family and style names of the installed font files, kept on disk so startup doesn't have to open
+// every font just to learn its name. Validated by directory modification times and file sizes.
+class FontCatalog
+{
+public:
+	struct Face
+	{
+		std::filesystem::path path;
+		long index;
+	};
+
+public:
+	explicit FontCatalog(std::filesystem::path _catalog_path) : catalog_path{ std::move(_catalog_path) } {}
+
+	// Returns false when there is no catalog or it has a different format
+	bool Load();
+	// Writes the catalog aside and moves it over the previous one
+	void Save() const;
+
+	// Whether the same roots were scanned and no directory or file has changed since
+	bool IsCurrent(const std::vector<std::filesystem::path>& roots) const;
+	// Walks the roots recursively, reading names only from files that are new or changed in size
+	void Refresh(const std::vector<std::filesystem::path>& roots);
+
+	// Faces by "Family Style". Files under earlier roots win over later ones with the same name.
+	auto faces() const -> std::unordered_map<std::string, Face>;
+
+private:
+	struct File
+	{
+		uintmax_t size;
+		// index of the root the file was found under
+		size_t root;
+		std::vector<std::pair<std::string, long>> faces;
+	};
+
+	// Reads names from the name table without FreeType, so scanning in the background can't race fonts being opened
+	static auto read_faces(const std::filesystem::path& path) -> std::vector<std::pair<std::string, long>>;
+
+private:
+	static constexpr uint32_t version = 2;
+	constexpr static std::array supported_extensions{ ".ttf", ".ttc", ".otf", ".otc" };
+
+	std::filesystem::path catalog_path;
+	std::vector<std::filesystem::path> roots;
+	std::map<std::filesystem::path::string_type, int64_t> directories;
+	std::map<std::filesystem::path::string_type, File> files;
+};
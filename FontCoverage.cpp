@@ -0,0 +1,125 @@
+#include "pch.h"
+
+#include "FontCoverage.h"
+
+#include <algorithm>
+
+#include "OpenType.h"
+
+using OpenType::read_u16, OpenType::read_u32;
+
+FontCoverage::FontCoverage()
+	: block_index((max_code_point >> block_bits) + 1, 0), blocks(1, Block{})
+{
+}
+
+void FontCoverage::add(char32_t first, char32_t last)
+{
+	last = std::min(last, max_code_point);
+	for (auto code_point = first; code_point <= last; ++code_point)
+	{
+		auto& index = block_index[code_point >> block_bits];
+		if (index == 0)
+		{
+			index = static_cast<uint16_t>(blocks.size());
+			blocks.emplace_back();
+		}
+
+		auto& word = blocks[index][(code_point >> 6) & (words_per_block - 1)];
+		const auto bit = uint64_t{ 1 } << (code_point & 63);
+		count += (word & bit) == 0;
+		word |= bit;
+	}
+}
+
+auto FontCoverage::parse(std::span<const std::byte> file, uint32_t face_index) -> std::optional<FontCoverage>
+{
+	const auto cmap = OpenType::find_table(file, face_index, OpenType::tag("cmap"));
+	if (cmap.empty())
+		return std::nullopt;
+
+	// full repertoire (format 12) beats the BMP only one (format 4), FreeType prefers the same subtables
+	size_t bmp_subtable = 0, full_subtable = 0;
+	const auto subtables = read_u16(cmap, 2);
+	for (uint32_t i = 0; i < subtables; ++i)
+	{
+		const auto record = 4 + 8 * static_cast<size_t>(i);
+		const auto platform = read_u16(cmap, record), encoding = read_u16(cmap, record + 2);
+		const size_t offset = read_u32(cmap, record + 4);
+		const auto unicode = platform == 0 || (platform == 3 && (encoding == 1 || encoding == 10));
+		if (!unicode || offset >= cmap.size())
+			continue;
+
+		switch (read_u16(cmap, offset))
+		{
+		case 4: if (!bmp_subtable) bmp_subtable = offset; break;
+		case 12: if (!full_subtable) full_subtable = offset; break;
+		}
+	}
+
+	auto coverage = FontCoverage{};
+	if (full_subtable)
+	{
+		const auto table = cmap.subspan(full_subtable);
+		const auto groups = read_u32(table, 12);
+		if (16 + 12 * static_cast<size_t>(groups) > table.size())
+			return std::nullopt;
+
+		for (uint32_t i = 0; i < groups; ++i)
+		{
+			const auto group = 16 + 12 * static_cast<size_t>(i);
+			const char32_t first = read_u32(table, group), last = read_u32(table, group + 4);
+			const auto glyph = read_u32(table, group + 8);
+			if (first > last || first > max_code_point)
+				continue;
+			// glyph 0 is .notdef, i.e. the code point is missing
+			coverage.add(glyph == 0 ? first + 1 : first, last);
+		}
+	}
+	else if (bmp_subtable)
+	{
+		const auto table = cmap.subspan(bmp_subtable);
+		const size_t segments = read_u16(table, 6) / 2;
+		const auto end_codes = size_t{ 14 }, start_codes = end_codes + 2 * segments + 2;
+		const auto deltas = start_codes + 2 * segments, range_offsets = deltas + 2 * segments;
+		if (range_offsets + 2 * segments > table.size())
+			return std::nullopt;
+
+		for (size_t i = 0; i < segments; ++i)
+		{
+			const char32_t first = read_u16(table, start_codes + 2 * i), last = read_u16(table, end_codes + 2 * i);
+			const auto delta = read_u16(table, deltas + 2 * i);
+			const auto range_offset = read_u16(table, range_offsets + 2 * i);
+			if (first > last)
+				continue;
+
+			for (auto code_point = first; code_point <= last && code_point != 0xFFFF; ++code_point)
+			{
+				auto glyph = uint32_t{};
+				if (range_offset == 0)
+				{
+					glyph = (code_point + delta) & 0xFFFF;
+				}
+				else
+				{
+					// offset is relative to the range offset entry itself
+					const auto address = range_offsets + 2 * i + range_offset + 2 * (code_point - first);
+					if (address + 2 > table.size())
+						break;
+					glyph = read_u16(table, address);
+					if (glyph)
+						glyph = (glyph + delta) & 0xFFFF;
+				}
+
+				if (glyph)
+					coverage.add(code_point, code_point);
+			}
+		}
+	}
+	else
+	{
+		return std::nullopt;
+	}
+
+	return coverage;
+}
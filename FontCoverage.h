@@ -0,0 +1,45 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <span>
+#include <optional>
+#include <cstddef>
+#include <cstdint>
+
+// Set of code points a font file maps to glyphs, read from its cmap table.
+// Testing a code point is two array lookups, unlike asking FreeType which searches the cmap every time.
+class FontCoverage
+{
+public:
+	static constexpr char32_t max_code_point = 0x10FFFF;
+
+	// Parses the Unicode cmap of face `face_index` in a TrueType/OpenType file or collection.
+	// Returns nullopt when the file has no usable cmap, e.g. bitmap .fon files or symbol fonts.
+	static auto parse(std::span<const std::byte> file, uint32_t face_index = 0) -> std::optional<FontCoverage>;
+
+	bool contains(char32_t code_point) const
+	{
+		if (code_point > max_code_point)
+			return false;
+		const auto& block = blocks[block_index[code_point >> block_bits]];
+		return (block[(code_point >> 6) & (words_per_block - 1)] >> (code_point & 63)) & 1;
+	}
+
+	auto code_points() const -> size_t { return count; }
+	auto memory() const -> size_t { return block_index.capacity() * sizeof(uint16_t) + blocks.capacity() * sizeof(Block); }
+
+private:
+	static constexpr int block_bits = 8;
+	static constexpr size_t words_per_block = (size_t{ 1 } << block_bits) / 64;
+	using Block = std::array<uint64_t, words_per_block>;
+
+	FontCoverage();
+	void add(char32_t first, char32_t last);
+
+private:
+	// every 256 code points share a bitmap block, block 0 is empty and shared by all unmapped ranges
+	std::vector<uint16_t> block_index;
+	std::vector<Block> blocks;
+	size_t count = 0;
+};
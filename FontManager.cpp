@@ -4,37 +4,315 @@
 
 #include <algorithm>
 #include <numeric>
+#include <chrono>
+#include <cstdlib>
+#include <atomic>
 
 #include <utf8cpp/utf8.h>
 
+#include "MappedFile.h"
+
 using namespace std::string_literals;
 
-void FontManager::Initialize()
+namespace
 {
-	for (std::filesystem::path directory : { "./fonts", "C:\\Windows\\Fonts" })
+	// Chains are only ever added, so names can be read without locking. Reached through a function
+	// so styles defined at namespace scope can intern their chains during static initialization.
+	class ChainRegistry
 	{
-		if (!exists(directory))
+	public:
+		static constexpr size_t capacity = 256;
+
+		ChainRegistry()
 		{
-			spdlog::debug(L"FontManager: {} does not exist. Skipping.", directory.native());
-			continue;
+			intern({});
+		}
+
+		auto intern(std::vector<std::string> names) -> uint32_t
+		{
+			std::scoped_lock lc{ mtx };
+			for (uint32_t id = 0; id < storage.size(); ++id)
+			{
+				if (*storage[id] == names)
+					return id;
+			}
+
+			ASSERT(storage.size() < capacity, "Too many font chains");
+			auto& stored = storage.emplace_back(std::make_unique<const std::vector<std::string>>(std::move(names)));
+			const auto id = static_cast<uint32_t>(storage.size() - 1);
+			entries[id].store(stored.get(), std::memory_order_release);
+			return id;
+		}
+
+		auto names(uint32_t id) const -> const std::vector<std::string>&
+		{
+			return *entries[id].load(std::memory_order_acquire);
 		}
 
-		for (auto& file : std::filesystem::directory_iterator(directory))
+	private:
+		std::mutex mtx;
+		std::vector<std::unique_ptr<const std::vector<std::string>>> storage;
+		std::array<std::atomic<const std::vector<std::string>*>, capacity> entries{};
+	};
+
+	auto chain_registry() -> ChainRegistry&
+	{
+		static ChainRegistry registry;
+		return registry;
+	}
+
+	// Bundled fonts first, so they win over installed ones of the same name
+	auto font_directories() -> std::vector<std::filesystem::path>
+	{
+		std::vector<std::filesystem::path> directories{ "./fonts" };
+#if defined(_WIN32) || defined(_WIN64)
+		directories.emplace_back("C:\\Windows\\Fonts");
+		wchar_t* local_app_data = nullptr;
+		size_t length = 0;
+		if (_wdupenv_s(&local_app_data, &length, L"LOCALAPPDATA") == 0 && local_app_data)
 		{
-			auto font = std::unique_ptr<TTF_Font>(TTF_OpenFont(utility::conversions::to_utf8string(file.path()).c_str(), 12));
-			if (font == nullptr)
-				continue;
+			// fonts installed for the current user only
+			directories.push_back(std::filesystem::path{ local_app_data } / "Microsoft" / "Windows" / "Fonts");
+			free(local_app_data);
+		}
+#else
+		directories.emplace_back("/usr/share/fonts");
+		directories.emplace_back("/usr/local/share/fonts");
+		if (auto home = std::getenv("HOME"))
+		{
+			directories.push_back(std::filesystem::path{ home } / ".local" / "share" / "fonts");
+			directories.push_back(std::filesystem::path{ home } / ".fonts");
+		}
+#endif
+		return directories;
+	}
+}
+
+FontChain::FontChain(std::initializer_list<std::string_view> names)
+	: chain_id{ chain_registry().intern(std::vector<std::string>(names.begin(), names.end())) }
+{
+}
+
+auto FontChain::names() const -> const std::vector<std::string>&
+{
+	return chain_registry().names(chain_id);
+}
+
+auto FontManager::ResolvedChain::select(char32_t code_point) const -> size_t
+{
+	for (size_t i = 0; i < fonts.size(); ++i)
+	{
+		if (coverage[i] ? coverage[i]->contains(code_point) : TTF_GlyphIsProvided32(fonts[i], code_point))
+			return i;
+	}
+	return fonts.size() - 1; // just use the last font even if it's missing the glyph
+}
+
+void FontManager::Initialize(const std::filesystem::path& catalog_path)
+{
+	const auto start = std::chrono::steady_clock::now();
+	const auto directories = font_directories();
 
-			auto family = std::string{ TTF_FontFaceFamilyName(font.get()) };
-			auto style = TTF_FontFaceStyleName(font.get());
-			font_files.insert({ family + ' ' + style, file.path() });
+	auto catalog = FontCatalog{ catalog_path };
+	if (catalog.Load())
+	{
+		set_font_files(catalog.faces());
+		if (!catalog.IsCurrent(directories))
+		{
+			// fonts already catalogued stay usable meanwhile, new ones become available once it's done
+			spdlog::info("FontManager: font directories have changed, refreshing the catalog in the background");
+			refreshing = pplx::create_task([this, directories, catalog = std::make_shared<FontCatalog>(std::move(catalog))] {
+				catalog->Refresh(directories);
+				catalog->Save();
+				set_font_files(catalog->faces());
+			});
 		}
 	}
+	else
+	{
+		spdlog::info("FontManager: no font catalog at {}, scanning font directories", catalog_path.string());
+		catalog.Refresh(directories);
+		catalog.Save();
+		set_font_files(catalog.faces());
+	}
+
+	spdlog::debug("FontManager: font names ready in {} ms",
+		std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+}
 
-	spdlog::debug("FontManager: {} fonts found: {}", font_files.size(), std::accumulate(font_files.begin(), font_files.end(), ""s, [](std::string list, const auto& font) {
+void FontManager::set_font_files(std::unordered_map<std::string, FontCatalog::Face> faces)
+{
+	spdlog::debug("FontManager: {} fonts found: {}", faces.size(), std::accumulate(faces.begin(), faces.end(), ""s, [](std::string list, const auto& font) {
 		if (list.size())
 			return std::move(list) + ", " + font.first;
 		else
 			return font.first;
 	}));
+
+	std::scoped_lock<std::mutex> lc{ write_mtx };
+	font_files = std::move(faces);
+}
+
+auto FontManager::get_file_hash(const TTF_Font* font) -> uint64_t
+{
+	std::filesystem::path path;
+	uint64_t size;
+	{
+		std::scoped_lock<std::mutex> lc{ write_mtx };
+		auto source = sources.find(font);
+		if (source == sources.end())
+			return 0;
+		if (auto hash = file_hashes.find(source->second.path.native()); hash != file_hashes.end())
+			return hash->second;
+		path = source->second.path;
+		size = source->second.file->size();
+	}
+
+	// size and modification time, like the font catalog checks its files. Hashing the contents read every byte of
+	// every font at startup.
+	std::error_code error;
+	const auto modified = std::filesystem::last_write_time(path, error);
+	const uint64_t stamp[] = { size, error ? UINT64_MAX : static_cast<uint64_t>(modified.time_since_epoch().count()) };
+	auto hash = hash_bytes(std::as_bytes(std::span{ stamp }));
+
+	std::scoped_lock<std::mutex> lc{ write_mtx };
+	file_hashes.insert_or_assign(path.native(), hash);
+	return hash;
+}
+
+auto FontManager::get_coverage(const TTF_Font* font) -> const FontCoverage*
+{
+	std::filesystem::path path;
+	long face;
+	std::shared_ptr<const MappedFile> file;
+	{
+		std::scoped_lock<std::mutex> lc{ write_mtx };
+		auto source = sources.find(font);
+		if (source == sources.end())
+			return nullptr;
+		if (auto coverage = coverages.find({ source->second.path.native(), source->second.face }); coverage != coverages.end())
+			return coverage->second.get();
+		path = source->second.path;
+		face = source->second.face;
+		file = source->second.file;
+	}
+
+	auto parsed = FontCoverage::parse(file->bytes(), static_cast<uint32_t>(face));
+	auto coverage = parsed ? std::make_unique<FontCoverage>(std::move(*parsed)) : nullptr;
+	if (coverage)
+		spdlog::debug("FontManager: {} covers {} code points", path.string(), coverage->code_points());
+	else
+		spdlog::debug("FontManager: {} has no Unicode cmap, falling back to SDL_ttf lookups", path.string());
+
+	// another thread may have parsed the same file meanwhile, the first result stays
+	std::scoped_lock<std::mutex> lc{ write_mtx };
+	return coverages.try_emplace({ path.native(), face }, std::move(coverage)).first->second.get();
+}
+
+auto FontManager::resolve(FontChain chain, int size) -> const ResolvedChain&
+{
+	const auto key = resolved_key(chain, size);
+	for (auto slot = resolved_slot(key);; slot = (slot + 1) & (resolved_capacity - 1))
+	{
+		const auto stored = resolved_keys[slot].load(std::memory_order_acquire);
+		if (stored == key)
+			return *resolved_values[slot].load(std::memory_order_relaxed);
+		if (stored == 0)
+			break;
+	}
+
+	{
+		std::scoped_lock<std::mutex> lc{ write_mtx };
+		if (auto it = resolved_chains.find(key); it != resolved_chains.end())
+			return *it->second;
+	}
+
+	// fonts are opened without holding the lock, get_font takes it itself
+	auto resolved = std::make_unique<ResolvedChain>();
+	for (const auto& name : chain.names())
+	{
+		auto font = get_font(name, size);
+		if (font == nullptr)
+			continue;
+
+		resolved->fonts.push_back(font);
+		resolved->font_ids.push_back(get_font_id(font));
+		resolved->coverage.push_back(get_coverage(font));
+	}
+
+	// none of the chain's fonts is installed, any face beats drawing nothing
+	if (resolved->fonts.empty())
+	{
+		std::vector<std::string> names;
+		{
+			std::scoped_lock<std::mutex> lc{ write_mtx };
+			for (const auto& [name, face] : font_files)
+				names.push_back(name);
+		}
+		std::sort(names.begin(), names.end());
+
+		for (const auto& name : names)
+		{
+			if (auto font = get_font(name, size))
+			{
+				spdlog::warn("FontManager: no font of chain {} could be loaded, falling back to {}", chain.id(), name);
+				resolved->fonts.push_back(font);
+				resolved->font_ids.push_back(get_font_id(font));
+				resolved->coverage.push_back(get_coverage(font));
+				break;
+			}
+		}
+	}
+
+	if (resolved->fonts.empty())
+	{
+		spdlog::error("FontManager: no font could be loaded for chain {}", chain.id());
+		// not kept, the catalog may still be refreshing
+		static const ResolvedChain none;
+		return none;
+	}
+
+	std::scoped_lock<std::mutex> lc{ write_mtx };
+	auto [it, inserted] = resolved_chains.try_emplace(key, std::move(resolved));
+	if (inserted && resolved_chains.size() <= resolved_capacity / 2)
+	{
+		auto slot = resolved_slot(key);
+		while (resolved_keys[slot].load(std::memory_order_relaxed) != 0)
+			slot = (slot + 1) & (resolved_capacity - 1);
+		// value first, readers only look at it after seeing the key
+		resolved_values[slot].store(it->second.get(), std::memory_order_relaxed);
+		resolved_keys[slot].store(key, std::memory_order_release);
+	}
+	return *it->second;
+}
+
+auto FontManager::GetStatistics() -> Statistics
+{
+	std::scoped_lock<std::mutex> lc{ write_mtx };
+
+	auto statistics = Statistics{ .files = mapped_files.size(), .fonts = fonts.size() };
+	for (const auto& [path, file] : mapped_files)
+	{
+		statistics.mapped_bytes += file->size();
+		statistics.resident_bytes += file->resident();
+	}
+	return statistics;
+}
+
+auto FontManager::map_file(const std::filesystem::path& path) -> std::shared_ptr<const MappedFile>
+{
+	auto& file = mapped_files[path.native()];
+	if (file == nullptr)
+	{
+		file = std::make_shared<const MappedFile>(path);
+		if (!*file)
+		{
+			spdlog::warn("FontManager: could not map {}", path.string());
+			// not kept, so the file is mapped again once it can be read
+			auto failed = std::move(file);
+			mapped_files.erase(path.native());
+			return failed;
+		}
+	}
+	return file;
 }
@@ -2,45 +2,161 @@
 
 #include <string>
 #include <unordered_map>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <filesystem>
 #include <array>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+#include <atomic>
+#include <string_view>
+#include <initializer_list>
 
 #include <SDL2/SDL_ttf.h>
 #include <cpprest/json.h>
+#include <pplx/pplxtasks.h>
 
 #include "Deleters.h"
+#include "FontCatalog.h"
+#include "FontCoverage.h"
+#include "MappedFile.h"
+
+// Interned list of font names, tried in order for every character. Cheap to copy and compare,
+// the same names always give the same chain. Can be created before the font manager is initialized.
+class FontChain
+{
+public:
+	FontChain() = default;
+	FontChain(std::initializer_list<std::string_view> names);
+
+	auto names() const -> const std::vector<std::string>&;
+	auto id() const -> uint32_t { return chain_id; }
+
+	bool operator==(const FontChain&) const = default;
+
+private:
+	// 0 is the empty chain
+	uint32_t chain_id = 0;
+};
 
 class FontManager
 {
 public:
-	void Initialize();
+	// Fonts of a chain at one pixel size
+	struct ResolvedChain
+	{
+		std::vector<TTF_Font*> fonts;
+		std::vector<uint16_t> font_ids;
+		// nullptr where the font file has no parsed cmap
+		std::vector<const FontCoverage*> coverage;
+
+		// Index of the first font providing the code point, the last font if none does
+		auto select(char32_t code_point) const -> size_t;
+	};
+
+	struct Statistics
+	{
+		size_t files;
+		size_t fonts;
+		// font files are mapped once and shared by every size
+		size_t mapped_bytes;
+		size_t resident_bytes;
+	};
+
+public:
+	// Takes font names from the catalog and refreshes it in the background when fonts were installed or removed.
+	// Without a catalog every font directory is scanned right away.
+	void Initialize(const std::filesystem::path& catalog_path = "cache/fonts.json");
 
 	auto get_font(const std::string& name, int size) -> TTF_Font*
 	{
-		auto key = name + std::to_string(size);
-		if (auto it = fonts.find(key); it != fonts.end())
+		std::scoped_lock<std::mutex> lc{ write_mtx };
+		if (auto it = fonts.find(name + std::to_string(size)); it != fonts.end())
 			return it->second.get();
 		else
 			return load_font(name, size);
 	}
 
+	// Opens the chain's fonts at `size` on first use. Later calls don't lock or allocate. Falls back to any catalogued
+	// face when none of the chain's fonts can be opened, the result has no fonts only when no font can be opened at all.
+	auto resolve(FontChain chain, int size) -> const ResolvedChain&;
+
+	// Opens an independent handle of the same face and size, for rasterizing on another thread
+	auto open_copy(const TTF_Font* font) -> std::unique_ptr<TTF_Font>
+	{
+		std::scoped_lock<std::mutex> lc{ write_mtx };
+		if (auto source = sources.find(font); source != sources.end())
+			return std::unique_ptr<TTF_Font>(open_mapped(*source->second.file, source->second.size, source->second.face));
+		else
+			return nullptr;
+	}
+
+	// Compact id of a loaded font. Ids are never reused, so caches keyed by them can't mix up faces.
+	auto get_font_id(const TTF_Font* font) -> uint16_t
+	{
+		std::scoped_lock<std::mutex> lc{ write_mtx };
+		if (auto source = sources.find(font); source != sources.end())
+			return source->second.id;
+		else
+			return std::numeric_limits<uint16_t>::max();
+	}
+
+	// Name and size the font was requested with, e.g. to persist data derived from it
+	auto get_name_and_size(const TTF_Font* font) -> std::optional<std::pair<std::string, int>>
+	{
+		std::scoped_lock<std::mutex> lc{ write_mtx };
+		if (auto source = sources.find(font); source != sources.end())
+			return std::make_pair(source->second.name, source->second.size);
+		else
+			return std::nullopt;
+	}
+
+	// Hash of the font file's size and modification time, computed once per file
+	auto get_file_hash(const TTF_Font* font) -> uint64_t;
+
+	// Code points covered by the font's face, parsed once per face and shared by all sizes.
+	// nullptr when the file has no usable cmap, SDL_ttf has to be asked then.
+	auto get_coverage(const TTF_Font* font) -> const FontCoverage*;
+
+	auto GetStatistics() -> Statistics;
+
 	void clear()
 	{
+		// the refresh publishes font names under the lock, it has to be done before they are cleared
+		if (refreshing != pplx::task<void>{})
+			refreshing.wait();
+
 		std::scoped_lock<std::mutex> lc{ write_mtx };
+		for (auto& key : resolved_keys)
+			key.store(0, std::memory_order_relaxed);
+		resolved_chains.clear();
+		sources.clear();
 		fonts.clear();
+		coverages.clear();
+		mapped_files.clear();
 	}
 
 private:
+	// Call with write_mtx held
 	auto load_font(const std::string& name, int size) -> TTF_Font*
 	{
 		if (auto file = font_files.find(name); file != font_files.end())
 		{
-			std::scoped_lock<std::mutex> lc{ write_mtx };
+			auto mapped = map_file(file->second.path);
+			auto opened = std::unique_ptr<TTF_Font>(open_mapped(*mapped, size, file->second.index));
+			// e.g. the file was removed or can't be read, nothing is cached so the next call tries again
+			if (opened == nullptr)
+			{
+				spdlog::warn("FontManager: could not open font {}: {}", name, TTF_GetError());
+				return nullptr;
+			}
 
-			auto key = name + std::to_string(size);
-			return fonts.insert_or_assign(key, std::unique_ptr<TTF_Font>(TTF_OpenFont(utility::conversions::to_utf8string(file->second).c_str(), size))).first->second.get();
+			auto font = fonts.insert_or_assign(name + std::to_string(size), std::move(opened)).first->second.get();
+			sources.insert_or_assign(font, Source{ name, file->second.path, file->second.index, size, next_font_id++, std::move(mapped) });
+			return font;
 		}
 		else
 		{
@@ -50,11 +166,60 @@ private:
 
 	}
 
+	// Mapping of the file shared with fonts already open, call with write_mtx held
+	auto map_file(const std::filesystem::path& path) -> std::shared_ptr<const MappedFile>;
+
+	// FreeType reads the face straight from the mapping, which has to outlive the font
+	static auto open_mapped(const MappedFile& file, int size, long face) -> TTF_Font*
+	{
+		if (!file)
+			return nullptr;
+		return TTF_OpenFontIndexRW(SDL_RWFromConstMem(file.data(), static_cast<int>(file.size())), 1, size, face);
+	}
+
+	void set_font_files(std::unordered_map<std::string, FontCatalog::Face> faces);
+
+	static constexpr auto resolved_key(FontChain chain, int size) -> uint64_t
+	{
+		return (static_cast<uint64_t>(chain.id()) << 32 | static_cast<uint32_t>(size)) + 1;
+	}
+	static constexpr auto resolved_slot(uint64_t key) -> size_t
+	{
+		return static_cast<size_t>((key * 0x9e3779b97f4a7c15ull) >> 32) & (resolved_capacity - 1);
+	}
+
+private:
+	struct Source
+	{
+		std::string name;
+		std::filesystem::path path;
+		// index of the face within a collection
+		long face;
+		int size;
+		uint16_t id;
+		std::shared_ptr<const MappedFile> file;
+	};
+
 private:
+	static constexpr size_t resolved_capacity = 1024;
+
 	std::mutex write_mtx;
+	// declared before fonts, so fonts are closed before their files are unmapped
+	std::unordered_map<std::filesystem::path::string_type, std::shared_ptr<const MappedFile>> mapped_files;
 	std::unordered_map<std::string, std::unique_ptr<TTF_Font>> fonts;
+	std::unordered_map<const TTF_Font*, Source> sources;
+	uint16_t next_font_id = 0;
+	std::unordered_map<std::filesystem::path::string_type, uint64_t> file_hashes;
+	std::map<std::pair<std::filesystem::path::string_type, long>, std::unique_ptr<FontCoverage>> coverages;
+
+	// Resolved chains by chain and size. Published with release stores into open addressing slots,
+	// so lookups never lock; once half the slots are used further chains are only found under the lock.
+	std::unordered_map<uint64_t, std::unique_ptr<ResolvedChain>> resolved_chains;
+	std::array<std::atomic<uint64_t>, resolved_capacity> resolved_keys{};
+	std::array<std::atomic<const ResolvedChain*>, resolved_capacity> resolved_values{};
 
-	std::unordered_map<std::string, std::filesystem::path> font_files;
-	constexpr static std::array supported_extensions{ ".ttf", ".ttc", ".fon" };
+	// "Family Style" to face, replaced as a whole when the catalog has been refreshed
+	std::unordered_map<std::string, FontCatalog::Face> font_files;
+	pplx::task<void> refreshing;
 };
 
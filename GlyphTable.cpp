@@ -0,0 +1,114 @@
+#include "pch.h"
+
+#include "GlyphTable.h"
+
+GlyphTable::Index::Index(size_t capacity)
+	: mask{ capacity - 1 }, keys{ new std::atomic<uint64_t>[capacity] }, ids{ new std::atomic<id_t>[capacity] }
+{
+	for (size_t i = 0; i < capacity; ++i)
+		keys[i].store(0, std::memory_order_relaxed);
+}
+
+void GlyphTable::Index::insert(uint64_t key, id_t id)
+{
+	auto i = slot(key, mask);
+	while (keys[i].load(std::memory_order_relaxed) != 0)
+		i = (i + 1) & mask;
+
+	// id must be visible before the key that makes it reachable
+	ids[i].store(id, std::memory_order_relaxed);
+	keys[i].store(key, std::memory_order_release);
+}
+
+GlyphTable::GlyphTable()
+{
+	clear();
+}
+
+auto GlyphTable::find(font_id_t font, char32_t code_point) const -> id_t
+{
+	const auto key = make_key(font, code_point);
+	const auto current = index.load(std::memory_order_acquire);
+
+	for (auto i = slot(key, current->mask);; i = (i + 1) & current->mask)
+	{
+		const auto stored = current->keys[i].load(std::memory_order_acquire);
+		if (stored == key)
+			return current->ids[i].load(std::memory_order_relaxed);
+		if (stored == 0)
+			return invalid_id;
+	}
+}
+
+auto GlyphTable::operator[](id_t id) const -> const Glyph&
+{
+	return chunks[id / chunk_size].load(std::memory_order_acquire)[id % chunk_size];
+}
+
+auto GlyphTable::at(id_t id) -> Glyph&
+{
+	return chunks[id / chunk_size].load(std::memory_order_relaxed)[id % chunk_size];
+}
+
+auto GlyphTable::insert(font_id_t font, char32_t code_point, const Glyph& glyph) -> id_t
+{
+	if (auto existing = find(font, code_point); existing != invalid_id)
+		return existing;
+
+	const auto id = static_cast<id_t>(count.load(std::memory_order_relaxed));
+	ASSERT(id / chunk_size < max_chunks, "Glyph table is full");
+
+	auto& chunk = chunks[id / chunk_size];
+	if (chunk.load(std::memory_order_relaxed) == nullptr)
+	{
+		chunk_storage.push_back(std::make_unique<Glyph[]>(chunk_size));
+		chunk.store(chunk_storage.back().get(), std::memory_order_release);
+	}
+	chunk.load(std::memory_order_relaxed)[id % chunk_size] = glyph;
+
+	// keep load factor at or below one half, probes stay short
+	auto current = index.load(std::memory_order_relaxed);
+	if ((id + 1) * 2 > current->mask + 1)
+	{
+		grow();
+		current = index.load(std::memory_order_relaxed);
+	}
+
+	current->insert(make_key(font, code_point), id);
+	count.store(id + 1, std::memory_order_release);
+
+	return id;
+}
+
+void GlyphTable::clear()
+{
+	indices.clear();
+	indices.push_back(std::make_unique<Index>(initial_capacity));
+	index.store(indices.back().get(), std::memory_order_release);
+
+	for (auto& chunk : chunks)
+		chunk.store(nullptr, std::memory_order_relaxed);
+	chunk_storage.clear();
+	count.store(0, std::memory_order_release);
+}
+
+auto GlyphTable::GetStatistics() const -> Statistics
+{
+	return { size(), index.load(std::memory_order_acquire)->mask + 1, resizes };
+}
+
+void GlyphTable::grow()
+{
+	const auto current = index.load(std::memory_order_relaxed);
+	auto grown = std::make_unique<Index>((current->mask + 1) * 2);
+
+	for (size_t i = 0; i <= current->mask; ++i)
+	{
+		if (auto key = current->keys[i].load(std::memory_order_relaxed); key != 0)
+			grown->insert(key, current->ids[i].load(std::memory_order_relaxed));
+	}
+
+	index.store(grown.get(), std::memory_order_release);
+	indices.push_back(std::move(grown));
+	++resizes;
+}
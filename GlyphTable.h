@@ -0,0 +1,99 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <limits>
+#include <cstdint>
+
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+struct Glyph
+{
+	SDL_Texture* texture;
+	SDL_Rect rect;
+	struct Metrics {
+		int minx = 0, maxx = 0, miny = 0, maxy = 0, advance = 0;
+		int height = 0, ascent = 0, descent = 0, line_skip = 0;
+	} metrics;
+	TTF_Font* font;
+	char32_t code_point;
+};
+
+// Glyphs keyed by compact font id and code point. The table only grows between clears and
+// inserts are serialized by the caller, so lookups never take a lock: entries are published
+// with release stores and a grown index replaces the old one atomically.
+class GlyphTable
+{
+public:
+	using id_t = uint32_t;
+	using font_id_t = uint16_t;
+
+	static constexpr id_t invalid_id = std::numeric_limits<id_t>::max();
+
+	struct Statistics
+	{
+		size_t glyphs;
+		size_t capacity;
+		uint32_t resizes;
+	};
+
+public:
+	GlyphTable();
+
+	// Safe to call from any thread, concurrently with insert
+	auto find(font_id_t font, char32_t code_point) const -> id_t;
+	auto operator[](id_t id) const -> const Glyph&;
+
+	// Writers must be serialized by the caller. Returns id of the inserted or already present glyph.
+	auto insert(font_id_t font, char32_t code_point, const Glyph& glyph) -> id_t;
+	// Writer access to stored glyph, e.g. to patch texture pointers
+	auto at(id_t id) -> Glyph&;
+	auto size() const -> size_t { return count.load(std::memory_order_acquire); }
+
+	// Must not run concurrently with readers
+	void clear();
+
+	auto GetStatistics() const -> Statistics;
+
+private:
+	// open addressing with linear probing, a zero key marks an empty slot
+	struct Index
+	{
+		size_t mask;
+		std::unique_ptr<std::atomic<uint64_t>[]> keys;
+		std::unique_ptr<std::atomic<id_t>[]> ids;
+
+		explicit Index(size_t capacity);
+		void insert(uint64_t key, id_t id);
+	};
+
+	static constexpr auto make_key(font_id_t font, char32_t code_point) -> uint64_t
+	{
+		return (static_cast<uint64_t>(font) << 32 | code_point) + 1;
+	}
+	static constexpr auto slot(uint64_t key, size_t mask) -> size_t
+	{
+		return static_cast<size_t>((key * 0x9e3779b97f4a7c15ull) >> 32) & mask;
+	}
+
+	void grow();
+
+private:
+	static constexpr size_t initial_capacity = 1024;
+	static constexpr size_t chunk_size = 1024;
+	static constexpr size_t max_chunks = 1024;
+
+	std::atomic<Index*> index{ nullptr };
+	// replaced indices stay alive until clear(), readers may still be probing them
+	std::vector<std::unique_ptr<Index>> indices;
+
+	// glyph storage never moves, so ids and references stay valid while the table grows
+	std::array<std::atomic<Glyph*>, max_chunks> chunks{};
+	std::vector<std::unique_ptr<Glyph[]>> chunk_storage;
+	std::atomic<size_t> count{ 0 };
+
+	std::atomic<uint32_t> resizes{ 0 };
+};
@@ -0,0 +1,429 @@
+#include "pch.h"
+
+#include "HttpCache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <cctype>
+
+#include <cpprest/containerstream.h>
+#include <nlohmann/json.hpp>
+
+#include "MappedFile.h"
+
+namespace
+{
+	auto now() -> int64_t
+	{
+		return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+	}
+
+	struct Freshness
+	{
+		int64_t max_age;
+		bool no_store;
+		bool no_cache;
+	};
+
+	constexpr size_t chunk_size = 16 * 1024;
+
+	// Reads the body into a single buffer as it arrives, which is handed to `progress` after every chunk
+	auto read_body(Concurrency::streams::istream stream, Concurrency::streams::container_buffer<std::vector<unsigned char>> buffer,
+		HttpCache::progress_t progress, pplx::cancellation_token token) -> pplx::task<std::vector<unsigned char>>
+	{
+		return stream.read(buffer, chunk_size).then([=](size_t read) {
+			if (token.is_canceled())
+				pplx::cancel_current_task();
+			if (read == 0)
+				return pplx::task_from_result(std::move(buffer.collection()));
+
+			progress(buffer.collection());
+			return read_body(stream, buffer, progress, token);
+		});
+	}
+
+	auto read_body(web::http::http_response response, HttpCache::progress_t progress, pplx::cancellation_token token) -> pplx::task<std::vector<unsigned char>>
+	{
+		if (!progress)
+			return response.extract_vector();
+
+		// sized up front when the length is known, so the buffer doesn't move while it fills
+		auto body = std::vector<unsigned char>{};
+		body.reserve(static_cast<size_t>(response.headers().content_length()));
+		return read_body(response.body(), Concurrency::streams::container_buffer<std::vector<unsigned char>>{ std::move(body), std::ios_base::out },
+			std::move(progress), token);
+	}
+
+	// Only what a private cache acts on: no-store, no-cache, max-age and Expires as a fallback
+	auto parse_freshness(const web::http::http_headers& headers) -> Freshness
+	{
+		auto freshness = Freshness{ -1, false, false };
+
+		utility::string_t value;
+		if (headers.match(web::http::header_names::cache_control, value))
+		{
+			auto directives = utility::conversions::to_utf8string(value);
+			std::transform(directives.begin(), directives.end(), directives.begin(), [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+
+			std::stringstream stream{ directives };
+			for (std::string directive; std::getline(stream, directive, ',');)
+			{
+				directive.erase(0, directive.find_first_not_of(" \t"));
+				directive.erase(directive.find_last_not_of(" \t") + 1);
+				if (directive == "no-store")
+					freshness.no_store = true;
+				else if (directive == "no-cache")
+					freshness.no_cache = true;
+				else if (directive.starts_with("max-age="))
+					freshness.max_age = std::strtoll(directive.c_str() + 8, nullptr, 10);
+			}
+		}
+
+		if (freshness.max_age < 0 && headers.match(web::http::header_names::expires, value))
+		{
+			// invalid dates, e.g. "0", mean already expired
+			const auto expires = utility::datetime::from_string(value, utility::datetime::RFC_1123);
+			const auto ticks_per_second = int64_t{ 10'000'000 };
+			freshness.max_age = expires.is_initialized()
+				? std::max<int64_t>(0, (static_cast<int64_t>(expires.to_interval()) - static_cast<int64_t>(utility::datetime::utc_now().to_interval())) / ticks_per_second)
+				: 0;
+		}
+
+		return freshness;
+	}
+
+	auto read_file(const std::filesystem::path& path) -> std::optional<std::vector<unsigned char>>
+	{
+		std::ifstream in(path, std::ios::binary);
+		if (!in)
+			return std::nullopt;
+
+		std::error_code error;
+		std::vector<unsigned char> body(std::filesystem::file_size(path, error));
+		if (error || !in.read(reinterpret_cast<char*>(body.data()), static_cast<std::streamsize>(body.size())))
+			return std::nullopt;
+		return body;
+	}
+}
+
+HttpCache::HttpCache(std::filesystem::path _directory, fetch_t fetch)
+	: directory{ std::move(_directory) }, fetcher{ std::move(fetch) }
+{
+}
+
+void HttpCache::Load()
+{
+	std::error_code error;
+	std::filesystem::create_directories(directory, error);
+
+	std::scoped_lock lc{ mtx };
+	if (std::ifstream in{ directory / "index.json", std::ios::binary })
+	{
+		try
+		{
+			const auto index = nlohmann::json::parse(in);
+			if (index.at("version").get<uint32_t>() == version)
+			{
+				for (const auto& item : index.at("entries"))
+				{
+					auto entry = Entry{
+						.blob = item.at("blob").get<std::string>(),
+						.etag = utility::conversions::to_string_t(item.at("etag").get<std::string>()),
+						.last_modified = utility::conversions::to_string_t(item.at("last_modified").get<std::string>()),
+						.stored = item.at("stored").get<int64_t>(),
+						.max_age = item.at("max_age").get<int64_t>(),
+						.no_cache = item.at("no_cache").get<bool>(),
+						.last_used = item.at("last_used").get<int64_t>(),
+					};
+
+					// bodies are named after their content, a different size means a damaged file
+					const auto size = std::filesystem::file_size(directory / entry.blob, error);
+					if (error || !entry.blob.ends_with('-' + std::to_string(size)))
+						continue;
+
+					auto [blob, inserted] = blobs.try_emplace(entry.blob, Blob{ static_cast<size_t>(size), 0 });
+					++blob->second.references;
+					if (inserted)
+						bytes += blob->second.size;
+					entries.insert_or_assign(utility::conversions::to_string_t(item.at("url").get<std::string>()), std::move(entry));
+				}
+			}
+		}
+		catch (const nlohmann::json::exception& exception)
+		{
+			spdlog::warn("HttpCache: {} is corrupted: {}", (directory / "index.json").string(), exception.what());
+			entries.clear();
+			blobs.clear();
+			bytes = 0;
+		}
+	}
+
+	// bodies written after the index was last saved, and leftovers of interrupted writes
+	size_t orphans = 0;
+	for (auto it = std::filesystem::directory_iterator(directory, error); !error && it != std::filesystem::directory_iterator{}; it.increment(error))
+	{
+		const auto name = it->path().filename().string();
+		if (name != "index.json" && !blobs.contains(name))
+		{
+			std::error_code remove_error;
+			orphans += std::filesystem::remove(it->path(), remove_error);
+		}
+	}
+
+	trim();
+	spdlog::info("HttpCache: {} urls, {} bodies, {} KiB in {}, {} orphans removed", entries.size(), blobs.size(), bytes / 1024, directory.string(), orphans);
+}
+
+void HttpCache::Save() const
+{
+	auto index = nlohmann::json{
+		{ "version", version },
+		{ "entries", nlohmann::json::array() },
+	};
+
+	{
+		std::scoped_lock lc{ mtx };
+		for (const auto& [url, entry] : entries)
+		{
+			index["entries"].push_back({
+				{ "url", utility::conversions::to_utf8string(url) },
+				{ "blob", entry.blob },
+				{ "etag", utility::conversions::to_utf8string(entry.etag) },
+				{ "last_modified", utility::conversions::to_utf8string(entry.last_modified) },
+				{ "stored", entry.stored },
+				{ "max_age", entry.max_age },
+				{ "no_cache", entry.no_cache },
+				{ "last_used", entry.last_used },
+			});
+		}
+	}
+
+	const auto path = directory / "index.json";
+	auto temporary = path;
+	temporary += ".tmp";
+	{
+		std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+		out << index.dump();
+		if (!out)
+		{
+			spdlog::warn("HttpCache: could not write {}", temporary.string());
+			return;
+		}
+	}
+
+	std::error_code error;
+	std::filesystem::rename(temporary, path, error);
+	if (error)
+		spdlog::warn("HttpCache: could not replace {}: {}", path.string(), error.message());
+}
+
+auto HttpCache::get(const utility::string_t& url, pplx::cancellation_token token, progress_t progress) -> pplx::task<std::vector<unsigned char>>
+{
+	std::unique_lock lc{ mtx };
+	auto it = entries.find(url);
+	if (it == entries.end())
+	{
+		++statistics.downloads;
+		lc.unlock();
+		return fetch(url, std::nullopt, token, std::move(progress));
+	}
+
+	auto& entry = it->second;
+	entry.last_used = now();
+	const auto cached = entry;
+	if (cached.no_cache)
+	{
+		lc.unlock();
+		return fetch(url, cached, token, std::move(progress));
+	}
+
+	const auto fresh = cached.max_age >= 0 && cached.last_used < cached.stored + cached.max_age;
+	if (fresh)
+		++statistics.fresh_hits;
+	else
+		++statistics.stale_hits;
+	const auto start_revalidation = !fresh && revalidating.insert(url).second;
+	lc.unlock();
+
+	if (start_revalidation)
+		revalidate(url, cached);
+
+	return pplx::create_task([this, url, token, progress, path = directory / cached.blob] {
+		if (auto body = read_file(path))
+			return pplx::task_from_result(std::move(*body));
+
+		// removed behind the index' back
+		spdlog::warn("HttpCache: {} is missing, downloading it again", path.string());
+		return fetch(url, std::nullopt, token, progress);
+	});
+}
+
+auto HttpCache::fetch(const utility::string_t& url, std::optional<Entry> cached, pplx::cancellation_token token, progress_t progress)
+	-> pplx::task<std::vector<unsigned char>>
+{
+	web::http::http_headers headers;
+	if (cached && !cached->etag.empty())
+		headers.add(web::http::header_names::if_none_match, cached->etag);
+	if (cached && !cached->last_modified.empty())
+		headers.add(web::http::header_names::if_modified_since, cached->last_modified);
+
+	return fetcher(url, headers, token).then([this, url, cached, token, progress](web::http::http_response response) {
+		if (cached && response.status_code() == web::http::status_codes::NotModified)
+		{
+			refresh(url, response.headers());
+			if (auto body = read_file(directory / cached->blob))
+				return pplx::task_from_result(std::move(*body));
+			return fetch(url, std::nullopt, token, progress);
+		}
+
+		return read_body(response, progress, token).then([this, url, response](std::vector<unsigned char> body) {
+			// error pages are handed over like before, but never kept
+			if (response.status_code() == web::http::status_codes::OK)
+				store(url, response.headers(), body);
+			return body;
+		});
+	});
+}
+
+void HttpCache::revalidate(const utility::string_t& url, Entry cached)
+{
+	fetch(url, std::move(cached), pplx::cancellation_token::none()).then([this, url](pplx::task<std::vector<unsigned char>> done) {
+		try
+		{
+			done.wait();
+		}
+		catch (const std::exception& error)
+		{
+			spdlog::warn("HttpCache: revalidating {} failed: {}", utility::conversions::to_utf8string(url), error.what());
+		}
+
+		std::scoped_lock lc{ mtx };
+		revalidating.erase(url);
+	});
+}
+
+void HttpCache::store(const utility::string_t& url, const web::http::http_headers& headers, const std::vector<unsigned char>& body)
+{
+	const auto freshness = parse_freshness(headers);
+	if (freshness.no_store)
+		return;
+
+	const auto blob = fmt::format("{:016x}-{}", hash_bytes(std::as_bytes(std::span{ body })), body.size());
+	const auto path = directory / blob;
+
+	// identical bodies are written once, concurrent writers of the same one each use their own temporary file
+	std::error_code error;
+	if (!std::filesystem::exists(path, error))
+	{
+		static std::atomic<uint64_t> writes{ 0 };
+		auto temporary = path;
+		temporary += fmt::format(".{}.tmp", ++writes);
+		{
+			std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+			out.write(reinterpret_cast<const char*>(body.data()), static_cast<std::streamsize>(body.size()));
+			if (!out)
+			{
+				spdlog::warn("HttpCache: could not write {}", temporary.string());
+				std::filesystem::remove(temporary, error);
+				return;
+			}
+		}
+		std::filesystem::rename(temporary, path, error);
+		if (error)
+		{
+			std::filesystem::remove(temporary, error);
+			return;
+		}
+	}
+
+	auto entry = Entry{ blob, {}, {}, now(), freshness.max_age, freshness.no_cache, now() };
+	headers.match(web::http::header_names::etag, entry.etag);
+	headers.match(web::http::header_names::last_modified, entry.last_modified);
+
+	std::scoped_lock lc{ mtx };
+	auto [it, inserted] = blobs.try_emplace(blob, Blob{ body.size(), 0 });
+	++it->second.references;
+	if (inserted)
+		bytes += body.size();
+
+	if (auto previous = entries.find(url); previous != entries.end())
+		release(previous->second.blob);
+	entries.insert_or_assign(url, std::move(entry));
+
+	trim();
+}
+
+void HttpCache::refresh(const utility::string_t& url, const web::http::http_headers& headers)
+{
+	const auto freshness = parse_freshness(headers);
+
+	std::scoped_lock lc{ mtx };
+	auto it = entries.find(url);
+	if (it == entries.end())
+		return;
+
+	++statistics.not_modified;
+	// 304 carries the same validators, servers may still update them
+	it->second.stored = now();
+	if (freshness.max_age >= 0)
+		it->second.max_age = freshness.max_age;
+	headers.match(web::http::header_names::etag, it->second.etag);
+	headers.match(web::http::header_names::last_modified, it->second.last_modified);
+}
+
+void HttpCache::SetBudget(size_t _budget)
+{
+	std::scoped_lock lc{ mtx };
+	budget = _budget;
+	trim();
+}
+
+auto HttpCache::GetStatistics() const -> Statistics
+{
+	std::scoped_lock lc{ mtx };
+	auto result = statistics;
+	result.entries = entries.size();
+	result.bytes = bytes;
+	result.budget = budget;
+	return result;
+}
+
+void HttpCache::remove(std::unordered_map<utility::string_t, Entry>::iterator it)
+{
+	release(it->second.blob);
+	entries.erase(it);
+}
+
+void HttpCache::release(const std::string& blob)
+{
+	auto it = blobs.find(blob);
+	if (it == blobs.end() || --it->second.references > 0)
+		return;
+
+	bytes -= it->second.size;
+	blobs.erase(it);
+
+	std::error_code error;
+	std::filesystem::remove(directory / blob, error);
+}
+
+void HttpCache::trim()
+{
+	if (bytes <= budget)
+		return;
+
+	std::vector<std::pair<int64_t, utility::string_t>> by_use;
+	by_use.reserve(entries.size());
+	for (const auto& [url, entry] : entries)
+		by_use.emplace_back(entry.last_used, url);
+	std::sort(by_use.begin(), by_use.end());
+
+	for (auto it = by_use.begin(); bytes > budget && it != by_use.end(); ++it)
+	{
+		remove(entries.find(it->second));
+		++statistics.evictions;
+	}
+}
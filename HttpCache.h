@@ -0,0 +1,110 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <optional>
+#include <functional>
+#include <filesystem>
+#include <span>
+#include <mutex>
+#include <cstdint>
+
+#include <cpprest/http_client.h>
+
+// Responses kept on disk between launches. Bodies are stored once per content hash and the index maps urls to them,
+// together with the validators used to revalidate them. Least recently used urls are dropped above the size cap.
+class HttpCache
+{
+public:
+	// Performs a GET of `url` with `headers` added, e.g. through an http_client or a local stand-in
+	using fetch_t = std::function<pplx::task<web::http::http_response>(const utility::string_t& url, const web::http::http_headers& headers,
+		pplx::cancellation_token token)>;
+	// Sees the whole body received so far after every chunk of a download. The beginning never changes, but the
+	// memory holding it may move between calls.
+	using progress_t = std::function<void(std::span<const unsigned char> received)>;
+
+	struct Statistics
+	{
+		// served from disk without asking the server
+		uint64_t fresh_hits;
+		// served from disk while being revalidated
+		uint64_t stale_hits;
+		// revalidations answered with 304 Not Modified
+		uint64_t not_modified;
+		uint64_t downloads;
+		uint64_t evictions;
+		size_t entries;
+		size_t bytes;
+		size_t budget;
+	};
+
+	static constexpr size_t default_budget = 256 * 1024 * 1024;
+
+public:
+	HttpCache(std::filesystem::path directory, fetch_t fetch);
+
+	// Reads the index and removes bodies it doesn't refer to, e.g. after a crash
+	void Load();
+	// Writes the index aside and moves it over the previous one
+	void Save() const;
+
+	// Fresh bodies come from disk. Stale ones come from disk too while a conditional request updates them
+	// in the background, unless the server asked for revalidation before every use. Others are downloaded.
+	// The token cancels requests made on the caller's behalf, background revalidations run to completion.
+	// Downloads report their progress to `progress`, bodies read from disk arrive whole.
+	auto get(const utility::string_t& url, pplx::cancellation_token token = pplx::cancellation_token::none(), progress_t progress = {})
+		-> pplx::task<std::vector<unsigned char>>;
+
+	void SetBudget(size_t bytes);
+	auto GetStatistics() const -> Statistics;
+
+private:
+	struct Entry
+	{
+		// file name of the body, derived from its hash and size
+		std::string blob;
+		utility::string_t etag;
+		utility::string_t last_modified;
+		// seconds since the epoch
+		int64_t stored;
+		// -1 when the response had no freshness information
+		int64_t max_age;
+		bool no_cache;
+		int64_t last_used;
+	};
+
+	struct Blob
+	{
+		size_t size;
+		size_t references;
+	};
+
+private:
+	// Requests the url, conditionally when `cached` is given, and stores a new body
+	auto fetch(const utility::string_t& url, std::optional<Entry> cached, pplx::cancellation_token token, progress_t progress = {})
+		-> pplx::task<std::vector<unsigned char>>;
+	void revalidate(const utility::string_t& url, Entry cached);
+	void store(const utility::string_t& url, const web::http::http_headers& headers, const std::vector<unsigned char>& body);
+	void refresh(const utility::string_t& url, const web::http::http_headers& headers);
+
+	// Helpers below expect mtx to be held
+	void remove(std::unordered_map<utility::string_t, Entry>::iterator it);
+	void release(const std::string& blob);
+	void trim();
+
+private:
+	static constexpr uint32_t version = 1;
+
+	std::filesystem::path directory;
+	fetch_t fetcher;
+
+	mutable std::mutex mtx;
+	std::unordered_map<utility::string_t, Entry> entries;
+	std::unordered_map<std::string, Blob> blobs;
+	std::unordered_set<utility::string_t> revalidating;
+	size_t bytes = 0;
+	size_t budget = default_budget;
+	Statistics statistics{};
+};
@@ -2,49 +2,582 @@
 
 #include "ImageManager.h"
 
+#include <cmath>
+
+#include <turbojpeg.h>
+
 #include "YouTubeCore.h"
+#include "ConnectionPool.h"
+#include "TextureManager.h"
 
 using namespace YouTube;
 using namespace std::string_literals;
+using Renderer::Dimensions::ActualPixelsSize;
+
+namespace
+{
+	// Smallest size of an image of `size` that still covers `target` once cropped to it, never larger than the image
+	auto cover_size(ActualPixelsSize size, ActualPixelsSize target) -> ActualPixelsSize
+	{
+		if (target.w <= 0 || target.h <= 0)
+			return size;
+
+		const auto scale = std::max(static_cast<double>(target.w) / size.w, static_cast<double>(target.h) / size.h);
+		if (scale >= 1.)
+			return size;
+		return { std::max(1, static_cast<int>(std::ceil(size.w * scale))), std::max(1, static_cast<int>(std::ceil(size.h * scale))) };
+	}
+
+	// covered when it's whole, or decoded for at least the wanted size
+	bool covers(ActualPixelsSize decoded, ActualPixelsSize wanted)
+	{
+		return decoded.w == 0 || (wanted.w != 0 && decoded.w >= wanted.w && decoded.h >= wanted.h);
+	}
+
+	bool is_jpeg(const std::vector<unsigned char>& data)
+	{
+		return data.size() > 3 && data[0] == 0xFF && data[1] == 0xD8 && data[2] == 0xFF;
+	}
+
+	// libjpeg-turbo skips most of the IDCT work when it scales while decoding, so the smallest of its scaling
+	// factors still covering `target` is used. Returns nothing for anything it can't decode.
+	auto decode_jpeg(const std::vector<unsigned char>& data, ActualPixelsSize target, ActualPixelsSize& full) -> std::unique_ptr<SDL_Surface>
+	{
+		auto decompressor = std::unique_ptr<void, decltype(&tjDestroy)>{ tjInitDecompress(), &tjDestroy };
+		if (!decompressor)
+			return nullptr;
+
+		int width, height, subsampling, colorspace;
+		if (tjDecompressHeader3(decompressor.get(), data.data(), static_cast<unsigned long>(data.size()), &width, &height, &subsampling, &colorspace) != 0)
+			return nullptr;
+		full = { width, height };
+
+		const auto cover = cover_size(full, target);
+		auto scaled = full;
+		int count = 0;
+		const auto factors = tjGetScalingFactors(&count);
+		for (int i = 0; i < count; ++i)
+		{
+			const auto w = TJSCALED(width, factors[i]), h = TJSCALED(height, factors[i]);
+			if (w <= width && w >= cover.w && h >= cover.h && w < scaled.w)
+				scaled = { w, h };
+		}
+
+		auto surface = std::unique_ptr<SDL_Surface>(SDL_CreateRGBSurfaceWithFormat(0, scaled.w, scaled.h, 32, SDL_PIXELFORMAT_ARGB8888));
+		if (!surface)
+			return nullptr;
+
+		// ARGB8888 is a packed format, its byte order follows the platform's
+		constexpr auto format = SDL_BYTEORDER == SDL_LIL_ENDIAN ? TJPF_BGRA : TJPF_ARGB;
+		const auto result = tjDecompress2(decompressor.get(), data.data(), static_cast<unsigned long>(data.size()), static_cast<unsigned char*>(surface->pixels),
+			scaled.w, surface->pitch, scaled.h, format, TJFLAG_FASTDCT);
+		// warnings are about recoverable damage, the image is still usable
+		if (result != 0 && tjGetErrorCode(decompressor.get()) != TJERR_WARNING)
+			return nullptr;
+		return surface;
+	}
+
+	// Bilinear filtering only looks at four source pixels, so large reductions are done in halving steps
+	auto shrink(std::unique_ptr<SDL_Surface> surface, ActualPixelsSize target) -> std::unique_ptr<SDL_Surface>
+	{
+		while (surface && (surface->w > target.w || surface->h > target.h))
+		{
+			const auto w = std::max(target.w, surface->w / 2), h = std::max(target.h, surface->h / 2);
+			auto smaller = std::unique_ptr<SDL_Surface>(SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_ARGB8888));
+			// keeps the larger image rather than none
+			if (!smaller || SDL_SoftStretchLinear(surface.get(), nullptr, smaller.get(), nullptr) != 0)
+				break;
+			surface = std::move(smaller);
+		}
+		return surface;
+	}
+}
+
+void ImageManager::Initialize(const std::filesystem::path& cache_directory)
+{
+	http_cache = std::make_unique<HttpCache>(cache_directory, [this](const utility::string_t& url, const web::http::http_headers& headers, pplx::cancellation_token token) {
+		return fetch(url, headers, token);
+	});
+	http_cache->Load();
+}
+
+void ImageManager::SaveCache()
+{
+	if (http_cache)
+		http_cache->Save();
+}
 
 ImageManager::img_task ImageManager::get_image(const utility::string_t& url)
 {
+	return get_image(url, pplx::cancellation_token::none());
+}
+
+ImageManager::img_task ImageManager::get_image(const utility::string_t& url, pplx::cancellation_token token)
+{
+	return get_image(url, 0, token);
+}
+
+ImageManager::img_task ImageManager::get_image(const utility::string_t& url, int priority, pplx::cancellation_token token, ActualPixelsSize size)
+{
+	auto task = img_task{};
+	auto id = uint64_t{};
+	auto pending = false;
+	{
+		auto lc = std::scoped_lock{ map_write };
+		auto it = images.find(url);
+		// decoded for a smaller window, requesters of the smaller load still get their image
+		if (it != images.end() && !covers(it->second.size, size))
+		{
+			remove(it);
+			it = images.end();
+		}
+
+		if (it != images.end())
+		{
+			++hits;
+			touch(it->second);
+		}
+		else
+		{
+			++misses;
+			it = load(url, priority, size);
+		}
+
+		auto& entry = it->second;
+		pending = !entry.task.is_done();
+		if (pending)
+		{
+			if (token.is_cancelable())
+				++entry.interest;
+			else
+				entry.detached = true;
+
+			if (entry.priority != priority)
+			{
+				entry.priority = priority;
+				scheduler.Prioritize(url, priority);
+			}
+		}
+		task = entry.task;
+		id = entry.id;
+	}
+
+	// runs right away when the token is cancelled already, so it can't be registered under the lock
+	if (pending && token.is_cancelable())
+		token.register_callback([this, url, id] { lose_interest(url, id); });
+
+	return task;
+}
+
+void ImageManager::load_image(const utility::string_t& url, pplx::cancellation_token token)
+{
+	auto lc = std::scoped_lock{ map_write };
+	if (auto it = images.find(url); it == images.end())
+		load(url, 0, {})->second.detached = true;
+}
+
+void ImageManager::Prioritize(const utility::string_t& url, int priority)
+{
+	auto lc = std::scoped_lock{ map_write };
+	if (auto it = images.find(url); it != images.end() && it->second.priority != priority && !it->second.task.is_done())
+	{
+		it->second.priority = priority;
+		scheduler.Prioritize(url, priority);
+	}
+}
+
+auto ImageManager::load(const utility::string_t& url, int priority, ActualPixelsSize size) -> std::unordered_map<utility::string_t, Entry>::iterator
+{
+	auto cancellation = pplx::cancellation_token_source{};
+	const auto token = cancellation.get_token();
+	const auto source = sources.contains(url) ? sources.at(url) : nullptr;
+	const auto id = ++next_id;
+
+	// images wanted at a display size show what has arrived while the rest downloads
+	auto progress = HttpCache::progress_t{};
+	if (size.w != 0)
+	{
+		progress = [this, url, id, size, decoder = std::make_shared<ProgressiveDecoder>(size)](std::span<const unsigned char> received) {
+			if (auto preview = decoder->Update(received))
+				queue_preview(url, id, std::move(preview), decoder->size(), size);
+		};
+	}
+
+	// started on a worker, fetch reads the priority under map_write
+	auto body = pplx::create_task([this, url, token, source, progress] {
+		if (source)
+			return pplx::task_from_result(*source);
+		if (http_cache)
+			return http_cache->get(url, token, progress);
+		return fetch(url, {}, token).then([](web::http::http_response response) {
+			return response.extract_vector();
+		});
+	}, token);
+
+	auto task = body.then([=](std::vector<unsigned char> data) {
+		return decode(url, id, std::move(data), size, [this, url, id] { evict(url, id); });
+	}).then([this, url, id](img_task loaded) {
+		// failures aren't cached, e.g. an error page or a dropped connection, so the next request tries again
+		try
+		{
+			auto image = loaded.get();
+			if (image == nullptr)
+				evict(url, id);
+			return image;
+		}
+		catch (...)
+		{
+			evict(url, id);
+			throw;
+		}
+	});
+
+	lru.push_front(url);
+	return images.insert_or_assign(url, Entry{ std::move(task), id, 0, frame, lru.begin(), priority, cancellation, 0, false, size, 0 }).first;
+}
+
+auto ImageManager::GetPreview(const utility::string_t& url) -> img_ptr
+{
+	auto lc = std::scoped_lock{ map_write };
 	if (auto it = images.find(url); it != images.end())
-		return it->second;
-	else
+		return it->second.preview;
+	return nullptr;
+}
+
+void ImageManager::evict(const utility::string_t& url)
+{
+	auto lc = std::scoped_lock{ map_write };
+	if (auto it = images.find(url); it != images.end())
+		remove(it);
+}
+
+void ImageManager::evict(const utility::string_t& url, uint64_t entry)
+{
+	// the texture may outlive its entry in tasks still held by callers, then the url may be cached again meanwhile
+	auto lc = std::scoped_lock{ map_write };
+	if (auto it = images.find(url); it != images.end() && it->second.id == entry)
+		remove(it);
+}
+
+void ImageManager::lose_interest(const utility::string_t& url, uint64_t entry)
+{
+	auto cancellation = pplx::cancellation_token_source{};
 	{
-		load_image(url);
-		return get_image(url);
+		auto lc = std::scoped_lock{ map_write };
+		auto it = images.find(url);
+		if (it == images.end() || it->second.id != entry || it->second.task.is_done())
+			return;
+		if (--it->second.interest > 0 || it->second.detached)
+			return;
+
+		cancellation = it->second.cancellation;
+		remove(it);
+		++cancelled;
 	}
+
+	// aborts the request, or drops it from the scheduler's queue
+	cancellation.cancel();
 }
 
-ImageManager::img_task ImageManager::get_image(const utility::string_t& url, pplx::cancellation_token token)
+void ImageManager::preload(const utility::string_t& url, std::shared_ptr<SDL_Texture> texture)
 {
+	g_TextureManager.Register(texture.get(), TextureManager::Category::Thumbnail);
+	const auto bytes = TextureManager::texture_bytes(texture.get());
+	auto rect = SDL_Rect{};
+	SDL_QueryTexture(texture.get(), nullptr, nullptr, &rect.w, &rect.h);
+	auto image = std::make_shared<const Image>(Image{ std::move(texture), rect });
+
+	auto lc = std::scoped_lock{ map_write };
 	if (auto it = images.find(url); it != images.end())
-		return it->second;
-	else
+		remove(it);
+	images.emplace(url, Entry{ pplx::task_from_result(std::move(image)), ++next_id, bytes, frame, lru.end(), 0, {}, 0, true, {}, bytes });
+	cached_bytes += bytes;
+	cached_full_bytes += bytes;
+}
+
+void ImageManager::preload(const utility::string_t& url, std::vector<unsigned char> data)
+{
+	auto lc = std::scoped_lock{ map_write };
+	if (auto it = images.find(url); it != images.end())
+		remove(it);
+	sources.insert_or_assign(url, std::make_shared<const std::vector<unsigned char>>(std::move(data)));
+}
+
+void ImageManager::clear()
+{
+	// pending uploads stay queued, thumbnails wait for them and surfaces survive a render device reset
 	{
-		load_image(url, token);
-		return get_image(url);
+		auto lc = std::scoped_lock{ map_write };
+		images.clear();
+		lru.clear();
+		cached_bytes = 0;
+		cached_full_bytes = 0;
 	}
+	atlas.Clear();
+
+	auto lc = std::scoped_lock{ statistics_mtx };
+	timings.clear();
 }
 
-void ImageManager::load_image(const utility::string_t& url, pplx::cancellation_token token)
+void ImageManager::Touch(const utility::string_t& url)
 {
-	auto [domain, uri] = parse_url(url);
+	auto lc = std::scoped_lock{ map_write };
+	if (auto it = images.find(url); it != images.end())
+		touch(it->second);
+}
 
+void ImageManager::SetBudget(size_t bytes)
+{
 	auto lc = std::scoped_lock{ map_write };
-	if (auto it = images.find(url); it != images.end()) return;
+	budget = bytes;
+}
+
+void ImageManager::touch(Entry& entry)
+{
+	entry.last_used = frame;
+	if (entry.position != lru.end())
+		lru.splice(lru.begin(), lru, entry.position);
+}
+
+void ImageManager::remove(std::unordered_map<utility::string_t, Entry>::iterator it)
+{
+	cached_bytes -= it->second.bytes;
+	cached_full_bytes -= it->second.full_bytes;
+	if (it->second.position != lru.end())
+		lru.erase(it->second.position);
+
+	{
+		auto lc = std::scoped_lock{ statistics_mtx };
+		timings.erase(it->first);
+	}
+
+	// releasing the task destroys the texture unless a caller still holds it
+	images.erase(it);
+}
+
+void ImageManager::trim()
+{
+	// images used in this or the previous frame are most likely on screen, so are all more recent ones
+	for (auto it = lru.end(); cached_bytes > budget && it != lru.begin();)
+	{
+		auto entry = images.find(*std::prev(it));
+		if (entry->second.last_used + 1 >= frame)
+			break;
+
+		// still loading, nothing to free yet
+		if (entry->second.bytes == 0)
+		{
+			--it;
+			continue;
+		}
+
+		remove(entry);
+		++evictions;
+	}
+}
+
+ImageManager::img_task ImageManager::decode(const utility::string_t& url, uint64_t entry, std::vector<unsigned char> data, ActualPixelsSize size, TextureManager::evictor_t evictor)
+{
+	return pplx::create_task([this, url, entry, data = std::move(data), size, evictor = std::move(evictor)] {
+		const auto start = std::chrono::steady_clock::now();
+		auto full = ActualPixelsSize{};
+		auto surface = is_jpeg(data) ? decode_jpeg(data, size, full) : nullptr;
+		if (!surface)
+		{
+			auto reader = SDL_RWFromConstMem(data.data(), static_cast<int>(data.size()));
+			surface.reset(IMG_Load_RW(reader, 1));
+			// converted here so that creating the texture is a plain copy
+			if (surface && surface->format->format != SDL_PIXELFORMAT_ARGB8888)
+				surface.reset(SDL_ConvertSurfaceFormat(surface.get(), SDL_PIXELFORMAT_ARGB8888, 0));
+			if (surface)
+				full = { surface->w, surface->h };
+		}
+		// other formats, and JPEGs between two scaling factors, are resized to the size they're displayed at
+		if (surface)
+			surface = shrink(std::move(surface), cover_size(full, size));
+		const auto decoded = std::chrono::steady_clock::now();
+
+		{
+			const auto decode_time = std::chrono::duration_cast<std::chrono::microseconds>(decoded - start);
+			auto lc = std::scoped_lock{ statistics_mtx };
+			++(surface ? statistics.decoded : statistics.failed);
+			statistics.decode_time += decode_time;
+			statistics.max_decode = std::max(statistics.max_decode, decode_time);
+		}
 
-	auto request = browser_request();
-	request.set_request_uri(uri);
+		if (!surface)
+		{
+			spdlog::warn("ImageManager: could not decode {}: {}", utility::conversions::to_utf8string(url), SDL_GetError());
+			return pplx::task_from_result(img_ptr{});
+		}
 
-	images.insert({ url, get_client(domain).request(request).then([=](web::http::http_response response) {
-		return response.extract_vector();
-	}).then([=](const std::vector<unsigned char>& data) {
-		auto reader = SDL_RWFromConstMem(data.data(), static_cast<int>(data.size()));
-		return std::shared_ptr<SDL_Texture>(g_Renderer.LoadTexture(reader));
-	}) });
+		auto upload = Upload{ url, entry, std::move(surface), evictor, {}, decoded - start, decoded, full, size };
+		auto uploaded = pplx::create_task(upload.uploaded);
+		{
+			auto lc = std::scoped_lock{ uploads_mtx };
+			uploads.push_back(std::move(upload));
+		}
+		return uploaded;
+	});
+}
+
+void ImageManager::queue_preview(const utility::string_t& url, uint64_t entry, std::unique_ptr<SDL_Surface> surface, ActualPixelsSize full, ActualPixelsSize size)
+{
+	// same size as the complete image, so both share atlas pages
+	surface = shrink(std::move(surface), cover_size(full, size));
+	if (!surface)
+		return;
+
+	auto upload = Upload{ url, entry, std::move(surface), {}, {}, {}, std::chrono::steady_clock::now(), full, size, true };
+	auto lc = std::scoped_lock{ uploads_mtx };
+	uploads.push_back(std::move(upload));
+}
+
+void ImageManager::ProcessUploads()
+{
+	using std::chrono::duration_cast, std::chrono::microseconds;
+
+	size_t frame_bytes = 0;
+	while (true)
+	{
+		Upload upload;
+		{
+			auto lc = std::scoped_lock{ uploads_mtx };
+			if (uploads.empty())
+				break;
+			const auto bytes = static_cast<size_t>(uploads.front().surface->pitch) * uploads.front().surface->h;
+			if (frame_bytes != 0 && frame_bytes + bytes > upload_budget)
+				break;
+			upload = std::move(uploads.front());
+			uploads.pop_front();
+		}
+
+		const auto start = std::chrono::steady_clock::now();
+		// the atlas slot goes back once every holder drops the image, TextureManager can only evict whole textures
+		auto image = upload.target.w != 0 ? atlas.Insert(upload.surface.get()) : nullptr;
+		if (image == nullptr)
+		{
+			if (auto texture = std::shared_ptr<SDL_Texture>{ g_Renderer.CreateTexture(upload.surface.get()) }; texture)
+			{
+				g_TextureManager.Register(texture.get(), TextureManager::Category::Thumbnail, std::move(upload.evictor));
+				image = std::make_shared<const Image>(Image{ std::move(texture), { 0, 0, upload.surface->w, upload.surface->h } });
+			}
+		}
+		const auto end = std::chrono::steady_clock::now();
+		if (image == nullptr)
+			spdlog::warn("ImageManager: could not upload {}: {}", utility::conversions::to_utf8string(upload.url), SDL_GetError());
+
+		const auto bytes = static_cast<size_t>(upload.surface->pitch) * upload.surface->h;
+		frame_bytes += bytes;
+
+		if (upload.preview)
+		{
+			auto lc = std::scoped_lock{ map_write };
+			// the complete image may be uploaded already when the preview had to wait for a later frame
+			auto it = images.find(upload.url);
+			if (image && it != images.end() && it->second.id == upload.entry && it->second.bytes == 0)
+			{
+				if (!it->second.preview)
+					it->second.first_pixel = end - it->second.started;
+				it->second.preview = std::move(image);
+
+				auto slc = std::scoped_lock{ statistics_mtx };
+				++statistics.previews;
+			}
+			continue;
+		}
+
+		auto timing = Timing{
+			.decode = duration_cast<microseconds>(upload.decode_time),
+			.queued = duration_cast<microseconds>(start - upload.decoded),
+			.upload = duration_cast<microseconds>(end - start),
+			.bytes = bytes,
+			.full_bytes = static_cast<size_t>(upload.full.w) * upload.full.h * SDL_BYTESPERPIXEL(SDL_PIXELFORMAT_ARGB8888),
+		};
+
+		{
+			auto lc = std::scoped_lock{ map_write };
+			// the entry may have been evicted or cleared while the image was loading
+			auto it = images.find(upload.url);
+			const auto cached = image && it != images.end() && it->second.id == upload.entry;
+			if (cached)
+			{
+				it->second.bytes = bytes;
+				it->second.full_bytes = timing.full_bytes;
+				cached_bytes += bytes;
+				cached_full_bytes += timing.full_bytes;
+				// nothing larger to decode anymore
+				if (upload.surface->w == upload.full.w && upload.surface->h == upload.full.h)
+					it->second.size = {};
+
+				it->second.preview = nullptr;
+				const auto complete = end - it->second.started;
+				timing.complete = duration_cast<microseconds>(complete);
+				timing.first_pixel = duration_cast<microseconds>(it->second.first_pixel != decltype(complete)::zero() ? it->second.first_pixel : complete);
+			}
+
+			auto slc = std::scoped_lock{ statistics_mtx };
+			if (cached)
+			{
+				timings.insert_or_assign(upload.url, timing);
+				++statistics.timed_loads;
+				statistics.first_pixel_time += timing.first_pixel;
+				statistics.complete_time += timing.complete;
+			}
+			++statistics.uploaded;
+			statistics.uploaded_bytes += bytes;
+			statistics.upload_time += timing.upload;
+			statistics.max_upload = std::max(statistics.max_upload, timing.upload);
+		}
+
+		upload.uploaded.set(std::move(image));
+	}
+
+	{
+		auto lc = std::scoped_lock{ map_write };
+		trim();
+		++frame;
+	}
+	// pages emptied by evictions, unless a thumbnail still shows one of their images
+	atlas.Trim();
+}
+
+void ImageManager::SetUploadBudget(size_t bytes)
+{
+	auto lc = std::scoped_lock{ uploads_mtx };
+	upload_budget = bytes;
+}
+
+auto ImageManager::GetTiming(const utility::string_t& url) -> std::optional<Timing>
+{
+	auto lc = std::scoped_lock{ statistics_mtx };
+	if (auto it = timings.find(url); it != timings.end())
+		return it->second;
+	return std::nullopt;
+}
+
+auto ImageManager::GetStatistics() -> Statistics
+{
+	auto pending = size_t{};
+	{
+		auto lc = std::scoped_lock{ uploads_mtx };
+		pending = uploads.size();
+	}
+
+	auto lc = std::scoped_lock{ map_write, statistics_mtx };
+	auto result = statistics;
+	result.pending_uploads = pending;
+	result.hits = hits;
+	result.misses = misses;
+	result.evictions = evictions;
+	result.cached_images = images.size();
+	result.cached_bytes = cached_bytes;
+	result.cached_full_bytes = cached_full_bytes;
+	result.budget = budget;
+	result.cancelled = cancelled;
+	result.fetches = scheduler.GetStatistics();
+	result.atlas = atlas.GetStatistics();
+	return result;
 }
 
 std::pair<utility::string_t, utility::string_t> ImageManager::parse_url(const utility::string_t& url)
@@ -60,10 +593,23 @@ std::pair<utility::string_t, utility::string_t> ImageManager::parse_url(const ut
 	};
 }
 
-web::http::client::http_client ImageManager::get_client(utility::string_t domain)
+pplx::task<web::http::http_response> ImageManager::fetch(const utility::string_t& url, const web::http::http_headers& headers, pplx::cancellation_token token)
 {
-	if (auto it = clients.find(domain); it != clients.end())
-		return it->second;
+	// revalidations of images nobody is waiting for go last
+	auto priority = FetchScheduler::background;
+	{
+		auto lc = std::scoped_lock{ map_write };
+		if (auto it = images.find(url); it != images.end() && !it->second.task.is_done())
+			priority = it->second.priority;
+	}
+
+	auto [domain, uri] = parse_url(url);
+	return scheduler.schedule(domain, url, priority, token, [domain = domain, uri = uri, headers](pplx::cancellation_token token) {
+		auto request = browser_request();
+		request.set_request_uri(uri);
+		for (const auto& [name, value] : headers)
+			request.headers().add(name, value);
 
-	return clients.insert({ domain, web::http::client::http_client{domain} }).first->second;
+		return g_ConnectionPool.Request(domain, std::move(request), token);
+	});
 }
@@ -2,6 +2,10 @@
 
 #include <unordered_map>
 #include <string>
+#include <list>
+#include <deque>
+#include <chrono>
+#include <optional>
 
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
@@ -10,6 +14,11 @@
 
 #include "Deleters.h"
 #include "Renderer.h"
+#include "TextureManager.h"
+#include "HttpCache.h"
+#include "FetchScheduler.h"
+#include "ThumbnailAtlas.h"
+#include "ProgressiveDecoder.h"
 
 inline auto browser_request()
 {
@@ -26,21 +35,194 @@ inline std::wstring str_to_wstr(const std::string& str)
 class ImageManager
 {
 public:
-	using img_ptr = std::shared_ptr<SDL_Texture>;
+	using ActualPixelsSize = Renderer::Dimensions::ActualPixelsSize;
+	// Images decoded for a display size share atlas pages, others get a texture of their own
+	using Image = ThumbnailAtlas::Image;
+	using img_ptr = ThumbnailAtlas::image_ptr;
 	using img_task = pplx::task<img_ptr>;
 
+	struct Timing
+	{
+		// decoding to a surface on a worker
+		std::chrono::microseconds decode;
+		// between decoding and the frame that uploaded it
+		std::chrono::microseconds queued;
+		// creating the texture on the render thread
+		std::chrono::microseconds upload;
+		size_t bytes;
+		// what the texture would take at the image's own size
+		size_t full_bytes;
+		// since the image was requested, until its first preview or the image itself was uploaded
+		std::chrono::microseconds first_pixel;
+		// since the image was requested, until the complete image was uploaded
+		std::chrono::microseconds complete;
+	};
+
+	struct Statistics
+	{
+		size_t decoded;
+		size_t failed;
+		size_t uploaded;
+		size_t pending_uploads;
+		size_t uploaded_bytes;
+		std::chrono::microseconds decode_time;
+		std::chrono::microseconds upload_time;
+		std::chrono::microseconds max_decode;
+		std::chrono::microseconds max_upload;
+
+		uint64_t hits;
+		uint64_t misses;
+		uint64_t evictions;
+		size_t cached_images;
+		// texture bytes of the uploaded images the cache holds
+		size_t cached_bytes;
+		// the same images decoded at their own size instead of the requested one
+		size_t cached_full_bytes;
+		size_t budget;
+		// loads dropped because every requester cancelled its token
+		uint64_t cancelled;
+		FetchScheduler::Statistics fetches;
+		ThumbnailAtlas::Statistics atlas;
+
+		// previews uploaded while images were downloading
+		uint64_t previews;
+		// loads timed from request to first pixel and to the complete image
+		uint64_t timed_loads;
+		std::chrono::microseconds first_pixel_time;
+		std::chrono::microseconds complete_time;
+	};
+
+	static constexpr size_t default_budget = 128 * 1024 * 1024;
+
 public:
+	// Downloads go through a disk cache in `cache_directory`. Without it every image is downloaded.
+	void Initialize(const std::filesystem::path& cache_directory = "cache/images");
+	void SaveCache();
+
 	img_task get_image(const utility::string_t& url);
 	img_task get_image(const utility::string_t& url, pplx::cancellation_token token);
+	// Requests are fetched in `priority` order, lower first. The load is cancelled once the token of every
+	// requester is cancelled before it completes, a later request starts it over.
+	// The image is decoded just large enough to cover `size` once cropped to it, an empty size keeps it whole.
+	// An image cached at a smaller size is decoded again.
+	img_task get_image(const utility::string_t& url, int priority, pplx::cancellation_token token, ActualPixelsSize size = {});
 	void load_image(const utility::string_t& url, pplx::cancellation_token token = pplx::cancellation_token::none());
+	// Changes the priority of a load that hasn't completed yet
+	void Prioritize(const utility::string_t& url, int priority);
+	// Latest preview of an image requested with a size that is still downloading, e.g. a progressive JPEG
+	auto GetPreview(const utility::string_t& url) -> img_ptr;
+
+	// Drops manager's reference to the image; holders of weak references reload it on demand
+	void evict(const utility::string_t& url);
+	void clear();
+
+	// Marks the image as used in the current frame, images unused for longer are evicted over the budget
+	void Touch(const utility::string_t& url);
+	// Texture bytes kept for downloaded images. Least recently used ones are evicted at the end of ProcessUploads.
+	void SetBudget(size_t bytes);
+
+	// Serves `texture` for `url` without fetching it, e.g. for synthetic feeds. Preloaded images are never evicted.
+	void preload(const utility::string_t& url, std::shared_ptr<SDL_Texture> texture);
+	// Serves an encoded image for `url` instead of downloading it. It's decoded at the requested sizes and
+	// evicted like a downloaded one.
+	void preload(const utility::string_t& url, std::vector<unsigned char> data);
+
+	// Uploads decoded images and evicts images over the budget, must be called once per frame on the render thread.
+	// Stops once the frame's upload budget is used up, the first pending image is always uploaded.
+	void ProcessUploads();
+	void SetUploadBudget(size_t bytes);
+
+	auto GetTiming(const utility::string_t& url) -> std::optional<Timing>;
+	auto GetStatistics() -> Statistics;
+
+private:
+	struct Entry
+	{
+		img_task task;
+		// a url loaded again after eviction gets a new id
+		uint64_t id;
+		// known once the texture is uploaded
+		size_t bytes;
+		uint64_t last_used;
+		// preloaded images aren't in the LRU list and are never evicted
+		std::list<utility::string_t>::iterator position;
+		int priority;
+		pplx::cancellation_token_source cancellation;
+		// requesters that may still cancel, and whether one that can't is waiting as well
+		uint32_t interest;
+		bool detached;
+		// size the image was decoded to cover, empty once it's at its own size
+		ActualPixelsSize size;
+		size_t full_bytes;
+		// dropped once the complete image is uploaded
+		img_ptr preview;
+		std::chrono::steady_clock::time_point started = std::chrono::steady_clock::now();
+		// zero until a preview was uploaded
+		std::chrono::steady_clock::duration first_pixel{};
+	};
+
+	struct Upload
+	{
+		utility::string_t url;
+		uint64_t entry;
+		std::unique_ptr<SDL_Surface> surface;
+		TextureManager::evictor_t evictor;
+		pplx::task_completion_event<img_ptr> uploaded;
+		std::chrono::steady_clock::duration decode_time;
+		std::chrono::steady_clock::time_point decoded;
+		// the image's own size, and the size it was decoded for
+		ActualPixelsSize full;
+		ActualPixelsSize target;
+		// shown until the complete image arrives, the task is left alone
+		bool preview = false;
+	};
 
 private:
 	std::pair<utility::string_t, utility::string_t> parse_url(const utility::string_t& url);
-	web::http::client::http_client get_client(utility::string_t domain);
+	pplx::task<web::http::http_response> fetch(const utility::string_t& url, const web::http::http_headers& headers, pplx::cancellation_token token);
+
+	// Starts loading the image, map_write must be held
+	auto load(const utility::string_t& url, int priority, ActualPixelsSize size) -> std::unordered_map<utility::string_t, Entry>::iterator;
+	// Decodes on a worker without touching the renderer, the task completes once the texture is uploaded
+	img_task decode(const utility::string_t& url, uint64_t entry, std::vector<unsigned char> data, ActualPixelsSize size, TextureManager::evictor_t evictor);
+	// Queues a partially decoded image for upload, called while the body downloads
+	void queue_preview(const utility::string_t& url, uint64_t entry, std::unique_ptr<SDL_Surface> surface, ActualPixelsSize full, ActualPixelsSize size);
+	// Evicts the url only while it still refers to the same load
+	void evict(const utility::string_t& url, uint64_t entry);
+	// Called when a requester's token is cancelled, cancels the load when it was the last one
+	void lose_interest(const utility::string_t& url, uint64_t entry);
+
+	// Helpers below expect map_write to be held
+	void touch(Entry& entry);
+	void remove(std::unordered_map<utility::string_t, Entry>::iterator it);
+	void trim();
 
 private:
-	std::unordered_map<utility::string_t, img_task> images;
-	std::unordered_map<utility::string_t, web::http::client::http_client> clients;
+	std::unordered_map<utility::string_t, Entry> images;
+	// encoded images served instead of downloads
+	std::unordered_map<utility::string_t, std::shared_ptr<const std::vector<unsigned char>>> sources;
+	std::unique_ptr<HttpCache> http_cache;
+	// most recently used first
+	std::list<utility::string_t> lru;
+	size_t cached_bytes = 0;
+	size_t cached_full_bytes = 0;
+	size_t budget = default_budget;
+	uint64_t next_id = 0;
+	uint64_t frame = 0;
+	uint64_t hits = 0, misses = 0, evictions = 0, cancelled = 0;
 
 	std::mutex map_write;
+
+	// priorities between images, connections are limited by g_ConnectionPool
+	FetchScheduler scheduler;
+
+	std::mutex uploads_mtx;
+	std::deque<Upload> uploads;
+	size_t upload_budget = 8 * 1024 * 1024;
+	// touched on the render thread only, apart from slots being released
+	ThumbnailAtlas atlas;
+
+	std::mutex statistics_mtx;
+	std::unordered_map<utility::string_t, Timing> timings;
+	Statistics statistics{};
 };
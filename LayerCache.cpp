@@ -0,0 +1,130 @@
+#include "pch.h"
+
+#include "LayerCache.h"
+
+#include <algorithm>
+
+#include "YouTubeCore.h"
+#include "TextureManager.h"
+
+using namespace YouTube;
+using namespace Renderer::Dimensions;
+
+void LayerCache::Invalidate(id_t owner)
+{
+	if (auto it = layers.find(owner); it != layers.end())
+	{
+		statistics.bytes -= it->second.bytes();
+		layers.erase(it);
+	}
+}
+
+void LayerCache::InvalidateAll()
+{
+	for (auto& [owner, layer] : layers)
+		layer.dirty = true;
+}
+
+void LayerCache::Clear()
+{
+	ASSERT(targets.empty(), "Layers cannot be cleared while rendering into one of them");
+
+	layers.clear();
+	statistics.bytes = 0;
+}
+
+void LayerCache::EndFrame()
+{
+	ASSERT(targets.empty(), "Unbalanced layer targets at the end of the frame");
+
+	if (statistics.bytes > budget)
+	{
+		std::vector<std::pair<uint64_t, id_t>> candidates;
+		for (const auto& [owner, layer] : layers)
+		{
+			// layers composited this frame are needed for the next one as well
+			if (layer.last_used < frame)
+				candidates.emplace_back(layer.last_used, owner);
+		}
+		std::sort(candidates.begin(), candidates.end());
+
+		for (auto it = candidates.begin(); it != candidates.end() && statistics.bytes > budget; ++it)
+		{
+			Invalidate(it->second);
+			++statistics.evictions;
+		}
+	}
+
+	if (++frame % 600 == 0)
+	{
+		spdlog::trace("LayerCache: {} layers, {} KiB, {} hits, {} misses, {} evictions",
+			layers.size(), statistics.bytes / 1024, statistics.hits, statistics.misses, statistics.evictions);
+	}
+}
+
+auto LayerCache::GetStatistics() const -> Statistics
+{
+	auto stats = statistics;
+	stats.layers = layers.size();
+	return stats;
+}
+
+auto LayerCache::clamp_to_target(ActualPixelsRectangle& rect) const -> bool
+{
+	auto bounds = targets.empty()
+		? ActualPixelsSize{ g_Renderer.GetSize().actual_width, g_Renderer.GetSize().actual_height }
+		: targets.back()->size;
+
+	rect.size.w = std::min(rect.size.w, bounds.w - rect.pos.x);
+	rect.size.h = std::min(rect.size.h, bounds.h - rect.pos.y);
+
+	return rect.size.w > 0 && rect.size.h > 0 && rect.pos.x + rect.size.w > 0 && rect.pos.y + rect.size.h > 0;
+}
+
+auto LayerCache::acquire(id_t owner, uint64_t version, ActualPixelsSize size, Renderer::Color background) -> Layer&
+{
+	auto& layer = layers[owner];
+	layer.last_used = frame;
+
+	if (layer.texture && layer.size == size)
+	{
+		if (layer.version == version && !layer.dirty)
+		{
+			++statistics.hits;
+			return layer;
+		}
+	}
+	else
+	{
+		statistics.bytes -= layer.bytes();
+		layer.texture = g_Renderer.CreateTexture(SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_TARGET, size.w, size.h, background, SDL_BLENDMODE_NONE);
+		g_TextureManager.Register(layer.texture.get(), TextureManager::Category::Layer, [this, owner] { Invalidate(owner); });
+		layer.size = size;
+		statistics.bytes += layer.bytes();
+	}
+
+	++statistics.misses;
+	layer.version = version;
+	layer.dirty = true;
+	return layer;
+}
+
+void LayerCache::push_target(const Layer& layer, Renderer::Color background)
+{
+	targets.push_back(&layer);
+	g_Renderer.SetRenderTarget(layer.texture.get());
+	g_Renderer.Clear(background);
+}
+
+void LayerCache::pop_target()
+{
+	targets.pop_back();
+	g_Renderer.SetRenderTarget(targets.empty() ? nullptr : targets.back()->texture.get());
+}
+
+void LayerCache::composite(const Layer& layer, ActualPixelsRectangle rect)
+{
+	auto srcrect = SDL_Rect{ 0, 0, rect.size.w, rect.size.h };
+	auto dstrect = SDL_Rect{ rect.pos.x, rect.pos.y, rect.size.w, rect.size.h };
+	g_Renderer.CopyTexture(layer.texture.get(), &srcrect, &dstrect, { 255, 255, 255, 255 });
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstdint>
+
+#include "Renderer.h"
+
+// Retained compositing layers. Each owner (a shelf row, an item card) renders into its own
+// target texture, which is reused until the owner's version, focus or size changes.
+class LayerCache
+{
+public:
+	using id_t = uint64_t;
+
+	struct Statistics
+	{
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		size_t bytes = 0;
+		size_t layers = 0;
+	};
+
+public:
+	static auto NewId() -> id_t { return next_id++; }
+
+	static auto Combine(uint64_t seed, uint64_t value) -> uint64_t
+	{
+		return seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+	}
+
+	// Composites owner's layer at `rect`. `draw` is called only when the cached texture is missing or stale
+	// and receives the rectangle in the layer's own coordinates. Everything outside of the current target is culled.
+	template <typename Func>
+	void Draw(id_t owner, uint64_t version, Renderer::Dimensions::ActualPixelsRectangle rect, Renderer::Color background, Func&& draw)
+	{
+		if (!clamp_to_target(rect))
+			return;
+
+		auto& layer = acquire(owner, version, rect.size, background);
+		if (!layer.texture)
+		{
+			// out of texture memory, draw straight into current target instead
+			draw(rect);
+			return;
+		}
+
+		if (layer.dirty)
+		{
+			push_target(layer, background);
+			draw(Renderer::Dimensions::ActualPixelsRectangle{ { 0, 0 }, rect.size });
+			pop_target();
+			layer.dirty = false;
+		}
+
+		composite(layer, rect);
+	}
+
+	void Invalidate(id_t owner);
+	// Marks every layer for re-rendering but keeps their textures, e.g. after render targets were reset
+	void InvalidateAll();
+	void Clear();
+
+	// Evicts least recently used layers over the budget. Call once per frame after presenting.
+	void EndFrame();
+
+	void SetBudget(size_t bytes) { budget = bytes; }
+	auto GetStatistics() const -> Statistics;
+
+private:
+	struct Layer
+	{
+		std::unique_ptr<SDL_Texture> texture;
+		Renderer::Dimensions::ActualPixelsSize size;
+		uint64_t version = 0;
+		uint64_t last_used = 0;
+		bool dirty = true;
+
+		auto bytes() const -> size_t { return texture ? static_cast<size_t>(size.w) * size.h * 4 : 0; }
+	};
+
+	auto clamp_to_target(Renderer::Dimensions::ActualPixelsRectangle& rect) const -> bool;
+	auto acquire(id_t owner, uint64_t version, Renderer::Dimensions::ActualPixelsSize size, Renderer::Color background) -> Layer&;
+	void push_target(const Layer& layer, Renderer::Color background);
+	void pop_target();
+	void composite(const Layer& layer, Renderer::Dimensions::ActualPixelsRectangle rect);
+
+private:
+	inline static std::atomic<id_t> next_id{ 1 };
+
+	std::unordered_map<id_t, Layer> layers;
+	std::vector<const Layer*> targets;
+
+	Statistics statistics;
+	uint64_t frame = 0;
+	size_t budget = 64 * 1024 * 1024;
+};
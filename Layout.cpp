@@ -0,0 +1,50 @@
+#include "pch.h"
+
+#include "Layout.h"
+
+#include <algorithm>
+
+#include "YouTubeCore.h"
+
+using namespace YouTube;
+using namespace Renderer::Dimensions;
+using namespace YouTube::UI::Layout;
+
+namespace
+{
+	struct RemBox
+	{
+		double x, y, w, h;
+	};
+
+	constexpr std::array<RemBox, static_cast<size_t>(Box::Count)> definitions{ {
+		/* MainContent */          { 8.5, 0., 0., 0. },
+		/* TopNavigation */        { 0., 0., 0., 6.5 },
+		/* ShelfRow */             { 0., 0., 0., 25.375 },
+		/* ShelfTitle */           { 3., 0.125 /* half of line/font height diff */, 0., 1.75 },
+		/* ShelfItems */           { 3., 0.125 + 1.5 /* font height */ + 0.125 + 1. /* margin-top of media item */, 0., 0. },
+		/* ShelfItemStride */      { 0., 0., 22., 0. },
+		/* Card */                 { -0.5, -0.5, 22., 20.4 }, // includes overhang of the focused thumbnail
+		/* CardThumbnail */        { 0.5, 0.5, 21., 11.75 },
+		/* CardThumbnailFocused */ { 0., 0., 22., 12.25 },
+		/* CardFocusedDetails */   { 0., 12.25, 22., 8.15 },
+		/* CardTitle */            { 0.5, 12.25, 21., 3.5 },
+		/* CardSecondary */        { 0.5, 12.25 + 3.5 + 0.5 /* title margin bottom */, 21., 1.25 },
+	} };
+}
+
+void YouTube::UI::Layout::Table::Update()
+{
+	if (generation == g_Renderer.GetGeneration())
+		return;
+
+	const double rem = 1_rem;
+	std::transform(definitions.begin(), definitions.end(), rects.begin(), [rem](const RemBox& box) {
+		return Rect{
+			static_cast<int>(box.x * rem), static_cast<int>(box.y * rem),
+			static_cast<int>(box.w * rem), static_cast<int>(box.h * rem)
+		};
+	});
+
+	generation = g_Renderer.GetGeneration();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "Renderer.h"
+
+namespace YouTube::UI::Layout
+{
+	// Plain pixel rectangle resolved by the layout pass
+	struct Rect
+	{
+		int x, y, w, h;
+
+		auto pos() const { return Renderer::Dimensions::ActualPixelsPoint{ x, y }; }
+		auto size() const { return Renderer::Dimensions::ActualPixelsSize{ w, h }; }
+
+		// Rectangle placed relative to `origin`
+		auto at(Renderer::Dimensions::ActualPixelsPoint origin) const
+		{
+			return Renderer::Dimensions::ActualPixelsRectangle{ { origin.x + x, origin.y + y }, { w, h } };
+		}
+	};
+
+	// Every box is relative to the element it belongs to (see Layout.cpp for the rem definitions)
+	enum class Box : uint8_t
+	{
+		MainContent,
+		TopNavigation,
+		ShelfRow,
+		ShelfTitle,
+		ShelfItems,
+		ShelfItemStride,
+		Card,
+		CardThumbnail,
+		CardThumbnailFocused,
+		CardFocusedDetails,
+		CardTitle,
+		CardSecondary,
+		Count
+	};
+
+	class Table
+	{
+	public:
+		// Resolves all boxes for current renderer size. Cheap to call every frame, does work only after a resize.
+		void Update();
+
+		auto operator[](Box box) const -> const Rect& { return rects[static_cast<size_t>(box)]; }
+
+	private:
+		std::array<Rect, static_cast<size_t>(Box::Count)> rects{};
+		uint32_t generation = 0;
+	};
+}
@@ -0,0 +1,144 @@
+#include "pch.h"
+
+#include "MappedFile.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#if defined(_WIN32) || defined(_WIN64)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <Windows.h>
+// resolves QueryWorkingSetEx to the kernel32 export, no psapi.lib needed
+#define PSAPI_VERSION 2
+#include <Psapi.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::filesystem::path& path)
+{
+#if defined(_WIN32) || defined(_WIN64)
+	auto file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file == INVALID_HANDLE_VALUE)
+		return;
+
+	LARGE_INTEGER file_size;
+	if (GetFileSizeEx(file, &file_size) && file_size.QuadPart > 0)
+	{
+		// mapping keeps the file open on its own
+		mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping)
+		{
+			view = static_cast<const std::byte*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			length = view ? static_cast<size_t>(file_size.QuadPart) : 0;
+		}
+	}
+	CloseHandle(file);
+#else
+	auto file = open(path.c_str(), O_RDONLY);
+	if (file == -1)
+		return;
+
+	struct stat file_stat;
+	if (fstat(file, &file_stat) == 0 && file_stat.st_size > 0)
+	{
+		auto address = mmap(nullptr, static_cast<size_t>(file_stat.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+		if (address != MAP_FAILED)
+		{
+			view = static_cast<const std::byte*>(address);
+			length = static_cast<size_t>(file_stat.st_size);
+		}
+	}
+	::close(file);
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+	close();
+}
+
+MappedFile::MappedFile(MappedFile&& other) noexcept
+	: view{ std::exchange(other.view, nullptr) }, length{ std::exchange(other.length, 0) }
+#if defined(_WIN32) || defined(_WIN64)
+	, mapping{ std::exchange(other.mapping, nullptr) }
+#endif
+{
+}
+
+MappedFile& MappedFile::operator=(MappedFile&& other) noexcept
+{
+	if (this != &other)
+	{
+		close();
+		view = std::exchange(other.view, nullptr);
+		length = std::exchange(other.length, 0);
+#if defined(_WIN32) || defined(_WIN64)
+		mapping = std::exchange(other.mapping, nullptr);
+#endif
+	}
+	return *this;
+}
+
+auto MappedFile::resident() const -> size_t
+{
+	if (view == nullptr)
+		return 0;
+
+#if defined(_WIN32) || defined(_WIN64)
+	SYSTEM_INFO system;
+	GetSystemInfo(&system);
+	const size_t page_size = system.dwPageSize;
+	const auto pages = (length + page_size - 1) / page_size;
+
+	std::vector<PSAPI_WORKING_SET_EX_INFORMATION> info(pages);
+	for (size_t i = 0; i < pages; ++i)
+		info[i].VirtualAddress = const_cast<std::byte*>(view) + i * page_size;
+	if (!QueryWorkingSetEx(GetCurrentProcess(), info.data(), static_cast<DWORD>(info.size() * sizeof(PSAPI_WORKING_SET_EX_INFORMATION))))
+		return 0;
+
+	const auto resident_pages = std::count_if(info.begin(), info.end(), [](const auto& page) { return page.VirtualAttributes.Valid; });
+#else
+	const auto page_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+	const auto pages = (length + page_size - 1) / page_size;
+
+	std::vector<unsigned char> info(pages);
+	if (mincore(const_cast<std::byte*>(view), length, info.data()))
+		return 0;
+
+	const auto resident_pages = std::count_if(info.begin(), info.end(), [](unsigned char page) { return page & 1; });
+#endif
+	return std::min(length, static_cast<size_t>(resident_pages) * page_size);
+}
+
+void MappedFile::close() noexcept
+{
+#if defined(_WIN32) || defined(_WIN64)
+	if (view)
+		UnmapViewOfFile(view);
+	if (mapping)
+		CloseHandle(mapping);
+	mapping = nullptr;
+#else
+	if (view)
+		munmap(const_cast<std::byte*>(view), length);
+#endif
+	view = nullptr;
+	length = 0;
+}
+
+auto hash_bytes(std::span<const std::byte> bytes) -> uint64_t
+{
+	auto hash = 0xcbf29ce484222325ull;
+	for (auto byte : bytes)
+	{
+		hash ^= static_cast<uint64_t>(byte);
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <filesystem>
+#include <span>
+#include <cstddef>
+#include <cstdint>
+
+// Read-only memory mapping of a whole file. Empty when the file doesn't exist or can't be mapped.
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	explicit MappedFile(const std::filesystem::path& path);
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	MappedFile(MappedFile&& other) noexcept;
+	MappedFile& operator=(MappedFile&& other) noexcept;
+
+	auto data() const -> const std::byte* { return view; }
+	auto size() const -> size_t { return length; }
+	auto bytes() const -> std::span<const std::byte> { return { view, length }; }
+	explicit operator bool() const { return view != nullptr; }
+
+	// Bytes of the mapping currently in physical memory, i.e. what the file costs in resident memory
+	auto resident() const -> size_t;
+
+private:
+	void close() noexcept;
+
+private:
+	const std::byte* view = nullptr;
+	size_t length = 0;
+#if defined(_WIN32) || defined(_WIN64)
+	void* mapping = nullptr;
+#endif
+};
+
+// 64-bit FNV-1a, used to name and identify cached data
+auto hash_bytes(std::span<const std::byte> bytes) -> uint64_t;
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <algorithm>
+#include <span>
+#include <cstddef>
+#include <cstdint>
+
+// Reading tables straight from TrueType/OpenType files and collections, without FreeType
+namespace OpenType
+{
+	// OpenType data is big-endian. Reads past the end yield zero, callers check bounds where it matters.
+	inline auto read_u16(std::span<const std::byte> data, size_t offset) -> uint32_t
+	{
+		if (offset + 2 > data.size())
+			return 0;
+		return static_cast<uint32_t>(data[offset]) << 8 | static_cast<uint32_t>(data[offset + 1]);
+	}
+
+	inline auto read_u32(std::span<const std::byte> data, size_t offset) -> uint32_t
+	{
+		return read_u16(data, offset) << 16 | read_u16(data, offset + 2);
+	}
+
+	constexpr auto tag(const char (&name)[5]) -> uint32_t
+	{
+		return static_cast<uint32_t>(name[0]) << 24 | static_cast<uint32_t>(name[1]) << 16 | static_cast<uint32_t>(name[2]) << 8 | static_cast<uint32_t>(name[3]);
+	}
+
+	// Faces in the file, 0 when it's neither a font nor a collection, e.g. a bitmap .fon
+	inline auto face_count(std::span<const std::byte> file) -> uint32_t
+	{
+		switch (read_u32(file, 0))
+		{
+		case tag("ttcf"):
+			// no more than the offset table can hold
+			return std::min<uint32_t>(read_u32(file, 8), static_cast<uint32_t>(std::min<size_t>(file.size() / 4, UINT32_MAX)));
+		case 0x00010000:
+		case tag("OTTO"):
+		case tag("true"):
+			return 1;
+		default:
+			return 0;
+		}
+	}
+
+	// Returns the table of the face, or an empty span
+	inline auto find_table(std::span<const std::byte> file, uint32_t face_index, uint32_t table_tag) -> std::span<const std::byte>
+	{
+		size_t face = 0;
+		if (read_u32(file, 0) == tag("ttcf"))
+		{
+			if (face_index >= read_u32(file, 8))
+				return {};
+			face = read_u32(file, 12 + 4 * static_cast<size_t>(face_index));
+		}
+		else if (face_index != 0)
+		{
+			return {};
+		}
+
+		const auto tables = read_u16(file, face + 4);
+		for (uint32_t i = 0; i < tables; ++i)
+		{
+			const auto record = face + 12 + 16 * static_cast<size_t>(i);
+			if (read_u32(file, record) != table_tag)
+				continue;
+
+			const size_t offset = read_u32(file, record + 8), length = read_u32(file, record + 12);
+			if (offset >= file.size() || length > file.size() - offset)
+				return {};
+			return file.subspan(offset, length);
+		}
+		return {};
+	}
+}
@@ -0,0 +1,285 @@
+#include "pch.h"
+
+#include "ProgressiveDecoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+
+#include <jpeglib.h>
+#include <webp/decode.h>
+
+using Renderer::Dimensions::ActualPixelsSize;
+
+namespace
+{
+	// Scale at which the image still covers `target` once cropped to it, never above 1
+	auto cover_scale(ActualPixelsSize size, ActualPixelsSize target) -> double
+	{
+		if (target.w <= 0 || target.h <= 0)
+			return 1.;
+		return std::min(1., std::max(static_cast<double>(target.w) / size.w, static_cast<double>(target.h) / size.h));
+	}
+}
+
+struct ProgressiveDecoder::Jpeg
+{
+	struct Error
+	{
+		jpeg_error_mgr manager;
+		std::jmp_buf jump;
+	};
+
+	enum class Stage { header, start, scans, finish_output, done };
+
+	jpeg_decompress_struct info{};
+	Error error{};
+	jpeg_source_mgr source{};
+	// start of the body the source pointers refer to
+	const unsigned char* base = nullptr;
+	// bytes libjpeg skipped before they arrived
+	size_t skip = 0;
+	Stage stage = Stage::header;
+	int shown_scan = 0;
+	// libjpeg reports errors with a longjmp, which skips destructors of locals
+	std::unique_ptr<SDL_Surface> output;
+
+	Jpeg()
+	{
+		info.err = jpeg_std_error(&error.manager);
+		error.manager.error_exit = [](j_common_ptr info) { std::longjmp(reinterpret_cast<Error*>(info->err)->jump, 1); };
+		// a truncated stream is expected, its warnings aren't worth printing
+		error.manager.output_message = [](j_common_ptr) {};
+		jpeg_create_decompress(&info);
+		info.client_data = this;
+
+		// running out of data suspends decoding, libjpeg backs up to where it can resume once more has arrived
+		source.init_source = [](j_decompress_ptr) {};
+		source.fill_input_buffer = [](j_decompress_ptr) -> boolean { return FALSE; };
+		source.skip_input_data = [](j_decompress_ptr info, long count) {
+			const auto requested = static_cast<size_t>(std::max(count, 0L));
+			const auto available = std::min(requested, info->src->bytes_in_buffer);
+			info->src->next_input_byte += available;
+			info->src->bytes_in_buffer -= available;
+			static_cast<Jpeg*>(info->client_data)->skip += requested - available;
+		};
+		source.resync_to_restart = jpeg_resync_to_restart;
+		source.term_source = [](j_decompress_ptr) {};
+		info.src = &source;
+	}
+
+	~Jpeg()
+	{
+		jpeg_destroy_decompress(&info);
+	}
+};
+
+struct ProgressiveDecoder::WebP
+{
+	// libwebp keeps pointers to the configuration and decodes straight into the surface
+	WebPDecoderConfig config{};
+	std::unique_ptr<SDL_Surface> surface;
+	WebPIDecoder* decoder = nullptr;
+	int shown_rows = 0;
+
+	~WebP()
+	{
+		if (decoder)
+			WebPIDelete(decoder);
+	}
+};
+
+ProgressiveDecoder::ProgressiveDecoder(ActualPixelsSize _target)
+	: target{ _target }
+{
+}
+
+ProgressiveDecoder::~ProgressiveDecoder() = default;
+
+auto ProgressiveDecoder::Update(std::span<const unsigned char> received) -> std::unique_ptr<SDL_Surface>
+{
+	if (format == Format::unknown && received.size() >= 12)
+	{
+		if (received[0] == 0xFF && received[1] == 0xD8 && received[2] == 0xFF)
+		{
+			format = Format::jpeg;
+			jpeg = std::make_unique<Jpeg>();
+		}
+		else if (std::memcmp(received.data(), "RIFF", 4) == 0 && std::memcmp(received.data() + 8, "WEBP", 4) == 0)
+		{
+			format = Format::webp;
+			webp = std::make_unique<WebP>();
+		}
+		else
+		{
+			format = Format::none;
+		}
+	}
+
+	switch (format)
+	{
+	case Format::jpeg:
+		return update_jpeg(received);
+	case Format::webp:
+		return update_webp(received);
+	default:
+		return nullptr;
+	}
+}
+
+auto ProgressiveDecoder::update_jpeg(std::span<const unsigned char> received) -> std::unique_ptr<SDL_Surface>
+{
+	auto& state = *jpeg;
+	auto& info = state.info;
+	if (state.stage == Jpeg::Stage::done)
+		return nullptr;
+
+	// data libjpeg hasn't consumed stays where it was, only the buffer holding it may have moved
+	const auto consumed = state.base ? static_cast<size_t>(state.source.next_input_byte - state.base) : 0;
+	const auto skipped = std::min(state.skip, received.size() - consumed);
+	state.skip -= skipped;
+	state.base = received.data();
+	state.source.next_input_byte = received.data() + consumed + skipped;
+	state.source.bytes_in_buffer = received.size() - consumed - skipped;
+
+	if (setjmp(state.error.jump))
+	{
+		// the complete image gets its own error when it's decoded
+		state.stage = Jpeg::Stage::done;
+		state.output = nullptr;
+		return nullptr;
+	}
+
+	if (state.stage == Jpeg::Stage::header)
+	{
+		if (jpeg_read_header(&info, TRUE) != JPEG_HEADER_OK)
+			return nullptr;
+
+		full = { static_cast<int>(info.image_width), static_cast<int>(info.image_height) };
+		// baseline images fill in from the top and decode quickly once complete
+		if (!jpeg_has_multiple_scans(&info))
+		{
+			state.stage = Jpeg::Stage::done;
+			return nullptr;
+		}
+
+		info.buffered_image = TRUE;
+		info.out_color_space = SDL_BYTEORDER == SDL_LIL_ENDIAN ? JCS_EXT_BGRA : JCS_EXT_ARGB;
+		info.dct_method = JDCT_IFAST;
+		// libjpeg-turbo scales by eighths while decoding
+		info.scale_num = std::clamp(static_cast<unsigned int>(std::ceil(cover_scale(full, target) * 8)), 1u, 8u);
+		info.scale_denom = 8;
+		state.stage = Jpeg::Stage::start;
+	}
+
+	if (state.stage == Jpeg::Stage::start)
+	{
+		if (!jpeg_start_decompress(&info))
+			return nullptr;
+		state.stage = Jpeg::Stage::scans;
+	}
+
+	if (state.stage == Jpeg::Stage::finish_output)
+	{
+		if (!jpeg_finish_output(&info))
+			return nullptr;
+		state.stage = Jpeg::Stage::scans;
+	}
+
+	// only completed scans are shown, showing the one being received would wait for the rest of it
+	auto completed = state.shown_scan;
+	while (true)
+	{
+		const auto status = jpeg_consume_input(&info);
+		if (status == JPEG_SUSPENDED)
+			break;
+		// the last scan is left to the decoding of the complete image
+		if (status == JPEG_REACHED_EOI)
+		{
+			state.stage = Jpeg::Stage::done;
+			return nullptr;
+		}
+		if (status == JPEG_SCAN_COMPLETED)
+			completed = info.input_scan_number;
+	}
+
+	if (completed == state.shown_scan)
+		return nullptr;
+
+	state.output.reset(SDL_CreateRGBSurfaceWithFormat(0, static_cast<int>(info.output_width), static_cast<int>(info.output_height), 32, SDL_PIXELFORMAT_ARGB8888));
+	if (!state.output)
+		return nullptr;
+
+	jpeg_start_output(&info, completed);
+	while (info.output_scanline < info.output_height)
+	{
+		auto row = static_cast<JSAMPROW>(state.output->pixels) + static_cast<size_t>(info.output_scanline) * state.output->pitch;
+		if (jpeg_read_scanlines(&info, &row, 1) == 0)
+			break;
+	}
+	state.shown_scan = completed;
+	// looks for the next scan, which usually hasn't arrived yet
+	state.stage = jpeg_finish_output(&info) ? Jpeg::Stage::scans : Jpeg::Stage::finish_output;
+	return std::move(state.output);
+}
+
+auto ProgressiveDecoder::update_webp(std::span<const unsigned char> received) -> std::unique_ptr<SDL_Surface>
+{
+	auto& state = *webp;
+	if (state.decoder == nullptr)
+	{
+		WebPInitDecoderConfig(&state.config);
+		const auto status = WebPGetFeatures(received.data(), received.size(), &state.config.input);
+		if (status == VP8_STATUS_NOT_ENOUGH_DATA)
+			return nullptr;
+		if (status != VP8_STATUS_OK)
+		{
+			format = Format::none;
+			return nullptr;
+		}
+
+		full = { state.config.input.width, state.config.input.height };
+		const auto scale = cover_scale(full, target);
+		const auto w = std::max(1, static_cast<int>(std::ceil(full.w * scale)));
+		const auto h = std::max(1, static_cast<int>(std::ceil(full.h * scale)));
+		state.surface.reset(SDL_CreateRGBSurfaceWithFormat(0, w, h, 32, SDL_PIXELFORMAT_ARGB8888));
+		if (!state.surface)
+		{
+			format = Format::none;
+			return nullptr;
+		}
+
+		state.config.options.use_scaling = w != full.w || h != full.h;
+		state.config.options.scaled_width = w;
+		state.config.options.scaled_height = h;
+		state.config.output.colorspace = SDL_BYTEORDER == SDL_LIL_ENDIAN ? MODE_BGRA : MODE_ARGB;
+		state.config.output.is_external_memory = 1;
+		state.config.output.u.RGBA.rgba = static_cast<uint8_t*>(state.surface->pixels);
+		state.config.output.u.RGBA.stride = state.surface->pitch;
+		state.config.output.u.RGBA.size = static_cast<size_t>(state.surface->pitch) * h;
+		state.decoder = WebPIDecode(nullptr, 0, &state.config);
+		if (state.decoder == nullptr)
+		{
+			format = Format::none;
+			return nullptr;
+		}
+	}
+
+	// reads the body where it is now, without copying it
+	if (WebPIUpdate(state.decoder, received.data(), received.size()) != VP8_STATUS_SUSPENDED)
+	{
+		// complete and decoded as usual, or broken
+		format = Format::none;
+		return nullptr;
+	}
+
+	// rows below the decoded ones are transparent, so the card shows through
+	int rows = 0;
+	if (WebPIDecGetRGB(state.decoder, &rows, nullptr, nullptr, nullptr) == nullptr || rows < state.shown_rows + state.surface->h / 4)
+		return nullptr;
+
+	state.shown_rows = rows;
+	return std::unique_ptr<SDL_Surface>(SDL_DuplicateSurface(state.surface.get()));
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <memory>
+#include <span>
+
+#include <SDL2/SDL.h>
+
+#include "Deleters.h"
+#include "Renderer.h"
+
+// Decodes the part of an image that has arrived so far, for previews while the rest downloads. Progressive JPEGs
+// give one preview per completed scan, WebPs one per quarter of their rows. Baseline JPEGs and other formats give
+// none. The complete image is decoded as usual, so the final pass is never repeated here.
+class ProgressiveDecoder
+{
+public:
+	using ActualPixelsSize = Renderer::Dimensions::ActualPixelsSize;
+
+public:
+	// Previews are scaled while decoding where the format allows, but never below `target`
+	explicit ProgressiveDecoder(ActualPixelsSize target);
+	~ProgressiveDecoder();
+
+	ProgressiveDecoder(const ProgressiveDecoder&) = delete;
+	ProgressiveDecoder& operator=(const ProgressiveDecoder&) = delete;
+
+	// `received` is the whole body so far. Returns an ARGB8888 preview when more can be shown than in the last one.
+	auto Update(std::span<const unsigned char> received) -> std::unique_ptr<SDL_Surface>;
+
+	// The image's own size, known once its header has arrived
+	auto size() const { return full; }
+
+private:
+	// decoder states, kept out of the header with their libraries
+	struct Jpeg;
+	struct WebP;
+
+	enum class Format { unknown, jpeg, webp, none };
+
+private:
+	auto update_jpeg(std::span<const unsigned char> received) -> std::unique_ptr<SDL_Surface>;
+	auto update_webp(std::span<const unsigned char> received) -> std::unique_ptr<SDL_Surface>;
+
+private:
+	ActualPixelsSize target;
+	ActualPixelsSize full;
+	Format format = Format::unknown;
+
+	std::unique_ptr<Jpeg> jpeg;
+	std::unique_ptr<WebP> webp;
+};
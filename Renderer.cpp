@@ -7,6 +7,7 @@
 #include <utf8cpp/utf8.h>
 
 #include "YouTubeCore.h"
+#include "TextureManager.h"
 
 using namespace std;
 using namespace Renderer;
@@ -19,7 +20,15 @@ using namespace YouTube;
 
 auto GuardedRenderer::CopyTexture(SDL_Texture* texture, const SDL_Rect* srcrect, const SDL_Rect* dstrect, Renderer::Color color) -> int
 {
+	g_TextureManager.Touch(texture);
+
 	GUARD();
+	++draw_calls;
+	if (texture != last_texture)
+	{
+		++texture_binds;
+		last_texture = texture;
+	}
 	SDL_SetTextureColorMod(texture, color.r, color.g, color.b);
 	SDL_SetTextureAlphaMod(texture, color.a);
 	return SDL_RenderCopy(renderer.get(), texture, srcrect, dstrect);
@@ -37,9 +46,30 @@ auto GuardedRenderer::CopyTexture(SDL_Texture* texture, const ActualPixelsRectan
 	return CopyTexture(texture, &sdl_srcrect, &sdl_dstrect, color);
 }
 
+auto GuardedRenderer::RenderGeometry(SDL_Texture* texture, const SDL_Vertex* vertices, int num_vertices, const int* indices, int num_indices) -> int
+{
+	g_TextureManager.Touch(texture);
+
+	GUARD();
+	++draw_calls;
+	if (texture != last_texture)
+	{
+		++texture_binds;
+		last_texture = texture;
+	}
+	if (texture)
+	{
+		SDL_SetTextureColorMod(texture, 255, 255, 255);
+		SDL_SetTextureAlphaMod(texture, 255);
+	}
+	return SDL_RenderGeometry(renderer.get(), texture, vertices, num_vertices, indices, num_indices);
+}
+
 auto GuardedRenderer::DrawBox(ActualPixelsRectangle rect, Color color) -> int
 {
 	GUARD();
+	++draw_calls;
+	last_texture = nullptr;
 	return boxRGBA(renderer.get(), rect.pos.x, rect.pos.y, rect.pos.x + rect.size.w, rect.pos.y + rect.size.h, color.r, color.g, color.b, color.a);
 }
 
@@ -59,7 +89,9 @@ auto GuardedRenderer::Clear(Color color) -> void
 auto GuardedRenderer::LoadTexture(SDL_RWops* src, bool freesrc) -> std::unique_ptr<SDL_Texture>
 {
 	GUARD();
-	return std::unique_ptr<SDL_Texture>(IMG_LoadTexture_RW(renderer.get(), src, freesrc));
+	auto ptr = std::unique_ptr<SDL_Texture>(IMG_LoadTexture_RW(renderer.get(), src, freesrc));
+	g_TextureManager.Register(ptr.get(), TextureManager::Category::Other);
+	return ptr;
 }
 
 auto GuardedRenderer::RenderTextToNewTexture(const utf8string& _text, TTF_Font* const font, Color color) -> std::unique_ptr<SDL_Texture>
@@ -69,21 +101,30 @@ auto GuardedRenderer::RenderTextToNewTexture(const utf8string& _text, TTF_Font*
 	utf8::utf16to8(_text.begin(), _text.end(), std::back_inserter(text));
 
 	auto surface = std::unique_ptr<SDL_Surface>(TTF_RenderUTF8_Blended(font, text.c_str(), color));
-	return std::unique_ptr<SDL_Texture>(SDL_CreateTextureFromSurface(renderer.get(), surface.get()));
+	auto ptr = std::unique_ptr<SDL_Texture>(SDL_CreateTextureFromSurface(renderer.get(), surface.get()));
+	g_TextureManager.Register(ptr.get(), TextureManager::Category::Other);
+	return ptr;
 }
 
 auto GuardedRenderer::CreateTexture(const int format, int access, int w, int h, Color color, SDL_BlendMode blend) -> std::unique_ptr<SDL_Texture>
 {
 	GUARD();
 	auto ptr = std::unique_ptr<SDL_Texture>(SDL_CreateTexture(renderer.get(), format, access, w, h));
+	if (ptr == nullptr)
+	{
+		spdlog::error("Could not create {}x{} texture: {}", w, h, SDL_GetError());
+		return ptr;
+	}
+	g_TextureManager.Register(ptr.get(), TextureManager::Category::Other);
 
 	SDL_SetTextureBlendMode(ptr.get(), SDL_BLENDMODE_NONE);
 
+	auto previous = SDL_GetRenderTarget(renderer.get());
 	SDL_SetRenderTarget(renderer.get(), ptr.get());
 	SDL_SetRenderDrawBlendMode(renderer.get(), SDL_BLENDMODE_NONE);
 	SDL_SetRenderDrawColor(renderer.get(), color.r, color.g, color.b, color.a);
 	SDL_RenderFillRect(renderer.get(), nullptr);
-	SDL_SetRenderTarget(renderer.get(), nullptr);
+	SDL_SetRenderTarget(renderer.get(), previous);
 
 	if (blend != SDL_BLENDMODE_NONE)
 		SDL_SetTextureBlendMode(ptr.get(), blend);
@@ -96,15 +137,48 @@ auto GuardedRenderer::CreateTexture(const int format, int access, int w, int h,
 auto GuardedRenderer::CreateTexture(SDL_Surface* surface) -> std::unique_ptr<SDL_Texture>
 {
 	GUARD();
-	return std::unique_ptr<SDL_Texture>(SDL_CreateTextureFromSurface(renderer.get(), surface));
+	auto ptr = std::unique_ptr<SDL_Texture>(SDL_CreateTextureFromSurface(renderer.get(), surface));
+	g_TextureManager.Register(ptr.get(), TextureManager::Category::Other);
+	return ptr;
+}
+
+auto GuardedRenderer::CreateStaticTexture(SDL_Surface* surface) -> std::unique_ptr<SDL_Texture>
+{
+	GUARD();
+	auto ptr = std::unique_ptr<SDL_Texture>(SDL_CreateTexture(renderer.get(), surface->format->format, SDL_TEXTUREACCESS_STATIC, surface->w, surface->h));
+	if (ptr == nullptr)
+	{
+		spdlog::error("Could not create {}x{} texture: {}", surface->w, surface->h, SDL_GetError());
+		return ptr;
+	}
+	g_TextureManager.Register(ptr.get(), TextureManager::Category::Other);
+
+	SDL_UpdateTexture(ptr.get(), nullptr, surface->pixels, surface->pitch);
+	SDL_SetTextureBlendMode(ptr.get(), SDL_BLENDMODE_BLEND);
+
+	return ptr;
+}
+
+auto GuardedRenderer::UpdateTexture(SDL_Texture* texture, const SDL_Rect* rect, SDL_Surface* src) -> int
+{
+	GUARD();
+	auto pixels = static_cast<const uint8_t*>(src->pixels) + rect->y * src->pitch + rect->x * src->format->BytesPerPixel;
+	return SDL_UpdateTexture(texture, rect, pixels, src->pitch);
+}
+
+auto GuardedRenderer::UpdateTexture(SDL_Texture* texture, const SDL_Rect* rect, const void* pixels, int pitch) -> int
+{
+	GUARD();
+	return SDL_UpdateTexture(texture, rect, pixels, pitch);
 }
 
 auto GuardedRenderer::CopyTextureToTexture(SDL_Texture* src, SDL_Texture* dest, const SDL_Rect* srcrect, const SDL_Rect* dstrect) -> int
 {
 	GUARD();
+	auto previous = SDL_GetRenderTarget(renderer.get());
 	SDL_SetRenderTarget(renderer.get(), dest);
 	SDL_RenderCopy(renderer.get(), src, srcrect, dstrect);
-	SDL_SetRenderTarget(renderer.get(), nullptr);
+	SDL_SetRenderTarget(renderer.get(), previous);
 	return 0;
 }
 
@@ -113,6 +187,14 @@ auto GuardedRenderer::CopySurfaceToTexture(SDL_Surface* src, SDL_Texture* dest,
 	return CopyTextureToTexture(CreateTexture(src).get(), dest, srcrect, dstrect);
 }
 
+auto GuardedRenderer::SetRenderTarget(SDL_Texture* target) -> SDL_Texture*
+{
+	GUARD();
+	auto previous = SDL_GetRenderTarget(renderer.get());
+	SDL_SetRenderTarget(renderer.get(), target);
+	return previous;
+}
+
 Renderer::Dimensions::ActualPixelsPoint::ActualPixelsPoint(ScaledPercentagePoint other)
 {
 	auto dim = g_Renderer.GetSize();
@@ -174,7 +256,7 @@ Renderer::Dimensions::ScaledPercentagePoint::ScaledPercentagePoint(ActualPixelsP
 
 Renderer::Dimensions::Rem::operator double() const
 {
-	return value * 16 * g_Renderer.scaled_width / 1280;
+	return value * g_Renderer.rem_size;
 }
 
 Renderer::Dimensions::RemPoint::RemPoint(ActualPixelsPoint other)
@@ -8,6 +8,8 @@
 #include <future>
 #include <queue>
 #include <functional>
+#include <thread>
+#include <atomic>
 
 #include <cpprest/details/basic_types.h>
 
@@ -24,7 +26,6 @@ namespace Renderer
 		{
 			Vec2D() : x{ T{0} }, y{ T{ 0 } } {}
 			Vec2D(T _x, T _y) : x{ _x }, y{ _y } {}
-			virtual ~Vec2D() {};
 			union { T x; T w; };
 			union { T y; T h; };
 		};
@@ -259,16 +260,36 @@ public:
 		{
 			scaled_height = static_cast<float>(height);
 		}
+		rem_size = 16.f * scaled_width / 1280.f;
+		++generation;
 	}
 	auto GetSize() const -> Dimensions
 	{
 		return { scaled_width, scaled_height, width, height };
 	}
+	// Total number of copy and fill calls issued so far
+	auto GetDrawCalls() const -> uint64_t
+	{
+		return draw_calls;
+	}
+	// Number of draw calls that used a different texture than the one before, i.e. batch breaks
+	auto GetTextureBinds() const -> uint64_t
+	{
+		return texture_binds;
+	}
+	// Incremented on every size update, so layouts can tell when they need to be resolved again
+	auto GetGeneration() const -> uint32_t
+	{
+		return generation;
+	}
 
 	auto CopyTexture(SDL_Texture* texture, const SDL_Rect* srcrect, const SDL_Rect* dstrect, Renderer::Color color = { 255, 255, 255, 0 }) -> int;
 	auto CopyTexture(SDL_Texture* texture, const SDL_Rect srcrect, const SDL_Rect dstrect, Renderer::Color color = { 255, 255, 255, 0 }) -> int;
 	auto CopyTexture(SDL_Texture* texture, const Renderer::Dimensions::ActualPixelsRectangle srcrect, const Renderer::Dimensions::ActualPixelsRectangle dstrect, Renderer::Color color = { 255, 255, 255, 0 }) -> int;
 
+	// Draws indexed triangles with the texture unmodulated, colours come from the vertices
+	auto RenderGeometry(SDL_Texture* texture, const SDL_Vertex* vertices, int num_vertices, const int* indices, int num_indices) -> int;
+
 	auto DrawBox(Renderer::Dimensions::ActualPixelsRectangle rect, Renderer::Color color) -> int;
 
 	auto Present() -> void;
@@ -280,16 +301,31 @@ public:
 
 	auto CreateTexture(const int format, int access, int w, int h, Renderer::Color color = Renderer::Color{ 0, 0, 0, 255 }, SDL_BlendMode blend = SDL_BLENDMODE_BLEND)->std::unique_ptr<SDL_Texture>;
 	auto CreateTexture(SDL_Surface* surface)->std::unique_ptr<SDL_Texture>;
+	// Static texture in surface's pixel format, so it can be updated straight from the surface later
+	auto CreateStaticTexture(SDL_Surface* surface)->std::unique_ptr<SDL_Texture>;
+	// Uploads `rect` region of `src` to the same region of `texture`
+	auto UpdateTexture(SDL_Texture* texture, const SDL_Rect* rect, SDL_Surface* src) -> int;
+	// Uploads `pixels` to `rect` of `texture`, e.g. into a slot of an atlas
+	auto UpdateTexture(SDL_Texture* texture, const SDL_Rect* rect, const void* pixels, int pitch) -> int;
 
 	auto CopyTextureToTexture(SDL_Texture* src, SDL_Texture* dest, const SDL_Rect* srcrect, const SDL_Rect* dstrect) -> int;
 	auto CopySurfaceToTexture(SDL_Surface* src, SDL_Texture* dest, const SDL_Rect* srcrect, const SDL_Rect* dstrect) -> int;
 
+	// Returns previous target so nested off-screen rendering can restore it
+	auto SetRenderTarget(SDL_Texture* target) -> SDL_Texture*;
+
 private:
 	mutable std::mutex renderer_mtx;
 	std::unique_ptr<SDL_Renderer> renderer;
 
 	int width{ 0 }, height{ 0 };
 	float scaled_width{ 0.f }, scaled_height{ 0.f };
+	float rem_size{ 0.f };
+	uint32_t generation{ 0 };
+
+	std::atomic<uint64_t> draw_calls{ 0 };
+	std::atomic<uint64_t> texture_binds{ 0 };
+	SDL_Texture* last_texture{ nullptr };
 
 	float ratio = 16.f / 9.f;
 };
@@ -358,8 +394,27 @@ namespace Renderer {
 			});
 		}
 
+		// Runs Func right away when called from the render thread (waiting would deadlock it),
+		// otherwise queues it and waits for the result
+		template <typename T>
+		auto invoke(T Func, priority level = priority::medium) -> decltype(Func(std::declval<GuardedRenderer*>()))
+		{
+			if (on_render_thread())
+				return Func(current_renderer);
+			return push(std::move(Func), level).get();
+		}
+
+		// The thread that last executed the queue
+		bool on_render_thread() const
+		{
+			return std::this_thread::get_id() == render_thread.load();
+		}
+
 		void execute_one(GuardedRenderer& renderer)
 		{
+			render_thread = std::this_thread::get_id();
+			current_renderer = &renderer;
+
 			if (tasks_count == 0) return;
 
 			task_t task;
@@ -376,6 +431,8 @@ namespace Renderer {
 	private:
 		mutable std::mutex mtx;
 		std::atomic_int tasks_count;
+		std::atomic<std::thread::id> render_thread;
+		GuardedRenderer* current_renderer = nullptr;
 		struct Compare
 		{
 			bool operator()(const item_t& a, const item_t& b)
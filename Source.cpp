@@ -28,6 +28,8 @@
 #include "YouTubeUI.h"
 #include "TextRenderer.h"
 #include "FontManager.h"
+#include "LayerCache.h"
+#include "TextureManager.h"
 
 using namespace std::chrono_literals;
 using namespace std::string_literals;
@@ -87,6 +89,9 @@ int main(int argc, char *argv[])
 
 	YouTube::YouTubeCoreRAII yt_core;
 
+	if (!g_TextRenderer.LoadCache("cache/glyphs.bin"))
+		YouTube::UI::prewarm_text();
+
 	YouTube::UI::MainMenu main_menu;
 
 	SDL_Event event;
@@ -100,13 +105,23 @@ int main(int argc, char *argv[])
 				switch (event.window.event)
 				{
 				case SDL_WINDOWEVENT_SIZE_CHANGED:
-					// Needs to destroy all textures using SDL_TEXTUREACCESS_TARGET which TextRenderer ahs plentiful
-					// https://forums.libsdl.org/viewtopic.php?p=40894
-					g_TextRenderer.ClearAll();
+					// glyph atlases are static textures and layers are keyed by size,
+					// actual texture loss is reported by SDL_RENDER_TARGETS_RESET or SDL_RENDER_DEVICE_RESET
 					g_Renderer.UpdateSize();
 					break;
 				}
 				break;
+			case SDL_RENDER_TARGETS_RESET:
+				// https://forums.libsdl.org/viewtopic.php?p=40894
+				spdlog::info("Render targets reset");
+				g_LayerCache.InvalidateAll();
+				break;
+			case SDL_RENDER_DEVICE_RESET:
+				spdlog::warn("Render device reset, restoring textures");
+				g_LayerCache.Clear();
+				g_TextRenderer.RestoreAtlases();
+				g_ImageManager.clear();
+				break;
 			case SDL_KEYDOWN:
 				for (auto it = g_KeyboardCallbacks.rbegin(); it != g_KeyboardCallbacks.rend(); ++it)
 				{
@@ -125,6 +140,7 @@ int main(int argc, char *argv[])
 		g_KeyboardCallbacks.clear();
 
 		g_RendererQueue.execute_one(g_Renderer);
+		g_ImageManager.ProcessUploads();
 
 		g_Renderer.Clear();
 
@@ -153,6 +169,8 @@ int main(int argc, char *argv[])
 			main_menu.display({{0, 0}, {dim.actual_width, dim.actual_height}});
 		}
 		g_Renderer.Present();
+		g_LayerCache.EndFrame();
+		g_TextureManager.EndFrame();
 	}
 
 	return 0;
@@ -3,226 +3,893 @@
 
 #include "YouTubeCore.h"
 #include "FontManager.h"
+#include "TextureManager.h"
+#include "MappedFile.h"
+#include "LayerCache.h"
+#include "Utf8.h"
 
 #include "cpprest/json.h"
 
 #include <SDL2/SDL2_gfxPrimitives.h>
+#include <pplx/pplxtasks.h>
+#include <utf8cpp/utf8.h>
 #include <numeric>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <cstring>
 
 using namespace YouTube;
 
 using namespace std::string_literals;
 
-void apply_kerning(std::vector<Glyph>& glyphs)
+namespace
 {
-    std::adjacent_difference(glyphs.rbegin(), glyphs.rend(), glyphs.rbegin(), [](const Glyph A, const Glyph B) -> Glyph {
-        auto ret = A;
-        if (A.font == B.font)
+    // Layout of the glyph cache file: header, fonts (each followed by its name), glyphs,
+    // then pages, each with its skyline and the rows in use. Native byte order, it never leaves the machine.
+    constexpr std::array<char, 4> cache_magic{ 'Y', 'T', 'G', 'C' };
+    constexpr uint32_t cache_version = 2;
+    constexpr uint32_t no_page = std::numeric_limits<uint32_t>::max();
+
+    struct CacheHeader
+    {
+        std::array<char, 4> magic;
+        uint32_t version;
+        uint32_t page_size;
+        uint32_t fonts;
+        uint32_t glyphs;
+        uint32_t pages;
+    };
+
+    // Pixel size already reflects renderer scale, so name, size and file hash identify the face completely
+    struct CachedFont
+    {
+        uint64_t file_hash;
+        int32_t size;
+        uint32_t name_length;
+    };
+
+    struct CachedGlyph
+    {
+        uint32_t font;
+        uint32_t code_point;
+        uint32_t page;
+        SDL_Rect rect;
+        Glyph::Metrics metrics;
+    };
+
+    struct CachedPage
+    {
+        uint32_t rows;
+        uint32_t segments;
+    };
+
+    // Bounds checked reads over a mapped file
+    class CacheReader
+    {
+    public:
+        explicit CacheReader(std::span<const std::byte> _bytes) : bytes{ _bytes } {}
+
+        template <typename T>
+        bool read(T& value) { return read(&value, sizeof(T)); }
+
+        bool read(void* destination, size_t count)
         {
-            ret.metrics.advance = ret.rect.w + TTF_GetFontKerningSizeGlyphs(A.font, static_cast<uint16_t>(A.code_point), static_cast<uint16_t>(B.code_point));
+            if (count > bytes.size())
+                return false;
+            std::memcpy(destination, bytes.data(), count);
+            bytes = bytes.subspan(count);
+            return true;
         }
-        else
+
+        // Returns an empty span if fewer than `count` bytes are left
+        auto take(size_t count) -> std::span<const std::byte>
         {
-            ret.metrics.advance = ret.rect.w;
+            if (count > bytes.size())
+                return {};
+            auto taken = bytes.first(count);
+            bytes = bytes.subspan(count);
+            return taken;
         }
-        return ret;
-    });
-}
 
-inline std::vector<Glyph> apply_kerning(std::vector<Glyph>&& glyphs)
-{
-    apply_kerning(glyphs);
+        // Sizes read from the file are checked against this before anything is allocated for them
+        auto remaining() const -> size_t { return bytes.size(); }
+
+    private:
+        std::span<const std::byte> bytes;
+    };
+
+    template <typename T>
+    void write(std::ofstream& out, const T& value)
+    {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    // Heap memory held by a shaped text, used to keep the shaping cache within its budget
+    auto shaped_text_bytes(const PreprocessedText& text) -> size_t
+    {
+        return sizeof(PreprocessedText) + text.glyphs.capacity() * sizeof(GlyphTable::id_t)
+            + text.advances.capacity() * sizeof(int) + text.words.capacity() * sizeof(Word);
+    }
+
+    // Latin, punctuation and kana, i.e. what nearly every home feed shows
+    auto common_characters() -> utf8string
+    {
+        constexpr std::array<std::pair<char32_t, char32_t>, 5> ranges{ {
+            { 0x20, 0x7E }, { 0xA0, 0xFF }, { 0x2010, 0x2027 }, { 0x3041, 0x3096 }, { 0x30A1, 0x30FA },
+        } };
 
-    return std::move(glyphs);
+        utf8string text;
+        for (auto [first, last] : ranges)
+        {
+            for (auto code_point = first; code_point <= last; ++code_point)
+                utf8::append(code_point, std::back_inserter(text));
+        }
+        return text;
+    }
 }
 
-std::vector<Word> group_into_words(const std::vector<Glyph>& glyphs)
+std::vector<int> apply_kerning(const GlyphTable& table, const std::vector<GlyphTable::id_t>& ids)
 {
-    std::vector<Word> words;
-    words.emplace_back();
-    for (auto glyph : glyphs) {
-        if (glyph.code_point == ' ')
+    std::vector<int> advances(ids.size());
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        const auto& glyph = table[ids[i]];
+        if (i + 1 == ids.size())
         {
-            // add advance and glyph without adding width and start next word
-            words.back().advance += glyph.metrics.advance;
-            words.back().characters.emplace_back(std::move(glyph));
-            words.emplace_back();
+            // nothing follows the last glyph, it keeps its own advance
+            advances[i] = glyph.metrics.advance;
         }
-        else if (glyph.code_point < 256)
+        else if (const auto& next = table[ids[i + 1]]; next.font == glyph.font)
         {
-            // add advance, width and glyph
-            words.back().width += glyph.metrics.advance;
-            words.back().advance += glyph.metrics.advance;
-            words.back().characters.emplace_back(std::move(glyph));
+            advances[i] = glyph.rect.w + TTF_GetFontKerningSizeGlyphs32(glyph.font, glyph.code_point, next.code_point);
         }
         else
         {
-            // finish word if non-zero length
-            if (words.back().characters.size())
-                words.emplace_back();
-
-            // add advance, width and glyph and start next word
-            words.back().width += glyph.metrics.advance;
-            words.back().advance += glyph.metrics.advance;
-            words.back().characters.emplace_back(std::move(glyph));
-            words.emplace_back();
+            advances[i] = glyph.rect.w;
         }
     }
-    if (words.size() && words.back().characters.size() == 0)
-        words.pop_back();
 
-    return words;
+    return advances;
 }
 
-std::unique_ptr<SDL_Texture> test;
-
-std::u32string to_u32string(std::u8string internal)
+std::vector<Word> group_into_words(const GlyphTable& table, const std::vector<GlyphTable::id_t>& ids, const std::vector<int>& advances)
 {
-    auto& f = std::use_facet<std::codecvt<char32_t, char8_t, std::mbstate_t>>(std::locale());
+    std::vector<Word> words{ Word{ 0, 0, 0, 0 } };
+    for (uint32_t i = 0; i < ids.size(); ++i)
+    {
+        const auto code_point = table[ids[i]].code_point;
+
+        // wide characters are words of their own, finish the current one if non-zero length
+        if (code_point >= 256 && words.back().count)
+            words.push_back({ i, 0, 0, 0 });
+
+        // spaces add advance without adding width
+        auto& word = words.back();
+        ++word.count;
+        word.advance += advances[i];
+        if (code_point != ' ')
+            word.width += advances[i];
 
-    // note that the following can be done with wstring_convert
-    std::mbstate_t mb{}; // initial shift state
-    std::basic_string<char32_t> external(internal.size() * f.max_length(), '\0');
-    const char8_t* from_next;
-    char32_t* to_next;
-    f.in(mb, &internal[0], &internal[internal.size()], from_next,
-        &external[0], &external[external.size()], to_next);
-    // error checking skipped for brevity
-    external.resize(to_next - &external[0]);
+        if (code_point == ' ' || code_point >= 256)
+            words.push_back({ i + 1, 0, 0, 0 });
+    }
+    if (words.back().count == 0)
+        words.pop_back();
 
-    return external;
+    return words;
 }
 
-std::u32string to_u32string(std::string text)
+std::unique_ptr<SDL_Texture> test;
+
+TextRenderer::TextRenderer()
 {
-    std::u8string internal;
-    std::copy(text.begin(), text.end(), std::back_inserter(internal));
-    return to_u32string(internal);
+    const auto workers = std::clamp(std::thread::hardware_concurrency(), 1u, 8u);
+    for (unsigned i = 0; i < workers; ++i)
+        rasterizers.push_back(std::make_unique<Rasterizer>());
 }
 
-PreprocessedText TextRenderer::PreprocessText(utf8string text, TextStyle style)
+auto TextRenderer::PreprocessText(const utf8string& text, const TextStyle& style) -> std::shared_ptr<const PreprocessedText>
 {
-    std::vector<TTF_Font*> fonts;
-    std::transform(style.fonts.begin(), style.fonts.end(), std::back_inserter(fonts), [size = style.size](const std::string& filename) {
-        return g_FontManager.get_font(filename, size);
+    const auto size = static_cast<int>(style.size);
+    const auto& chain = g_FontManager.resolve(style.fonts, size);
+    // nothing to shape with, the text stays empty
+    if (chain.fonts.empty())
+        return std::make_shared<const PreprocessedText>();
+
+    auto hash = std::hash<std::string_view>{}(text);
+    hash = LayerCache::Combine(hash, style.fonts.id());
+    hash = LayerCache::Combine(hash, static_cast<uint64_t>(size));
+
+    const auto generation = atlas_generation.load();
+    {
+        std::scoped_lock lc{ shaping_mtx };
+        if (auto it = shaped_index.find(hash); it != shaped_index.end())
+        {
+            auto entry = it->second;
+            if (entry->generation == generation && entry->size == size && entry->fonts == style.fonts && entry->text == text)
+            {
+                shaped_texts.splice(shaped_texts.begin(), shaped_texts, entry);
+                ++shaped_hits;
+                return entry->shaped;
+            }
+        }
+    }
+    ++shaped_misses;
+
+    // decoded code points are only needed while shaping, so every thread keeps reusing one buffer
+    thread_local std::u32string code_points;
+    decode_utf8(text, code_points);
+
+    auto ids = transform_to_glyphs(code_points, chain);
+    auto advances = apply_kerning(glyphs, ids);
+    auto words = group_into_words(glyphs, ids, advances);
+    auto shaped = std::make_shared<const PreprocessedText>(PreprocessedText{
+        .glyphs = std::move(ids),
+        .advances = std::move(advances),
+        .words = std::move(words),
+        .line_height = TTF_FontLineSkip(chain.fonts.front())
     });
 
-    return {
-        .words = group_into_words(
-            apply_kerning(transform_to_glyphs(to_u32string(text), fonts))
-        ),
-        .line_height = TTF_FontLineSkip(*fonts.begin())
-    };
+    std::scoped_lock lc{ shaping_mtx };
+    if (auto it = shaped_index.find(hash); it != shaped_index.end())
+    {
+        // stale or colliding entry, the newest result wins
+        shaped_bytes -= it->second->bytes;
+        shaped_texts.erase(it->second);
+        shaped_index.erase(it);
+    }
+
+    const auto bytes = shaped_text_bytes(*shaped) + text.size();
+    shaped_texts.push_front({ hash, text, style.fonts, size, generation, shaped, bytes });
+    shaped_index.emplace(hash, shaped_texts.begin());
+    shaped_bytes += bytes;
+
+    // results still referenced by elements stay alive, the cache only drops its own reference
+    while (shaped_bytes > shaping_budget && shaped_texts.size() > 1)
+    {
+        shaped_bytes -= shaped_texts.back().bytes;
+        shaped_index.erase(shaped_texts.back().hash);
+        shaped_texts.pop_back();
+    }
+
+    return shaped;
 }
 
 void TextRenderer::Render(utf8string text, Renderer::Dimensions::ActualPixelsRectangle rect, TextStyle style)
 {
-    Render(PreprocessText(text, style), rect, style.color);
+    Render(*PreprocessText(text, style), rect, style.color);
 }
 
 void TextRenderer::Render(const PreprocessedText& text, Renderer::Dimensions::ActualPixelsRectangle rect, Renderer::Color color)
+{
+    auto layout = Layout(text, rect.size);
+    Render(layout, rect, color);
+}
+
+void TextRenderer::Render(TextLayout& layout, Renderer::Dimensions::ActualPixelsRectangle rect, Renderer::Color color)
 {
     g_Renderer.DrawBox(rect, { 0.5f, 0.0f, 0.5f, 0.5f });
 
-    auto max_lines = floor(static_cast<float>(rect.size.h) / text.line_height);
+    if (layout.vertices.empty())
+        return;
+
+    const SDL_Color vertex_color = color;
+    const auto& last_color = layout.placed_color;
+    if (layout.placed.size() != layout.vertices.size() || layout.placed_at.x != rect.pos.x || layout.placed_at.y != rect.pos.y
+        || last_color.r != vertex_color.r || last_color.g != vertex_color.g || last_color.b != vertex_color.b || last_color.a != vertex_color.a)
+    {
+        layout.placed = layout.vertices;
+        for (auto& vertex : layout.placed)
+        {
+            vertex.position.x += rect.pos.x;
+            vertex.position.y += rect.pos.y;
+            vertex.color = vertex_color;
+        }
+        layout.placed_at = rect.pos;
+        layout.placed_color = vertex_color;
+    }
+
+    for (const auto& run : layout.runs)
+        g_Renderer.RenderGeometry(run.texture, layout.placed.data(), static_cast<int>(layout.placed.size()), layout.indices.data() + run.first_index, run.index_count);
+}
+
+auto TextRenderer::Layout(const PreprocessedText& text, Renderer::Dimensions::ActualPixelsSize size) -> TextLayout
+{
+    auto layout = TextLayout{ .source = &text, .size = size, .generation = atlas_generation };
+
+    auto max_lines = floor(static_cast<float>(size.h) / text.line_height);
 
     if (text.words.size() == 0)
-        return;
+        return layout;
+
+    // indices are gathered per atlas page first, so each page is drawn with a single call
+    std::vector<std::pair<SDL_Texture*, std::vector<int>>> page_indices;
+    auto add_quad = [&](const Glyph& glyph, float x, float y) {
+        constexpr auto texture_size = static_cast<float>(AtlasPage::size);
+        const auto first = static_cast<int>(layout.vertices.size());
+        const auto w = static_cast<float>(glyph.rect.w), h = static_cast<float>(glyph.rect.h);
+        const auto u = glyph.rect.x / texture_size, v = glyph.rect.y / texture_size;
+        const auto du = w / texture_size, dv = h / texture_size;
+
+        layout.vertices.push_back({ { x, y }, { 255, 255, 255, 255 }, { u, v } });
+        layout.vertices.push_back({ { x + w, y }, { 255, 255, 255, 255 }, { u + du, v } });
+        layout.vertices.push_back({ { x + w, y + h }, { 255, 255, 255, 255 }, { u + du, v + dv } });
+        layout.vertices.push_back({ { x, y + h }, { 255, 255, 255, 255 }, { u, v + dv } });
+
+        auto page = std::find_if(page_indices.begin(), page_indices.end(), [&glyph](const auto& entry) { return entry.first == glyph.texture; });
+        if (page == page_indices.end())
+            page = page_indices.emplace(page_indices.end(), glyph.texture, std::vector<int>{});
+        page->second.insert(page->second.end(), { first, first + 1, first + 2, first, first + 2, first + 3 });
+    };
 
-    auto glyph_position = rect.pos;
-    glyph_position.y += TTF_FontAscent(text.words[0].characters[0].font);
+    auto glyph_position = Renderer::Dimensions::ActualPixelsPoint{ 0, TTF_FontAscent(glyphs[text.glyphs[text.words[0].first]].font) };
 
-    auto remaining_width = rect.size.w;    
+    auto remaining_width = size.w;
     auto line_count = 1;
     for (auto it = text.words.begin(); it != text.words.end() && line_count <= max_lines; ++it)
     {
         if (it->width > remaining_width)
         {
-            glyph_position.x = rect.pos.x;
+            glyph_position.x = 0;
             glyph_position.y += text.line_height;
-            remaining_width = rect.size.w;
+            remaining_width = size.w;
             ++line_count;
             continue;
         }
 
-        for (auto glyph : it->characters)
+        for (auto i = it->first; i < it->first + it->count; ++i)
         {
-            g_Renderer.CopyTexture(glyph.texture, glyph.rect, { {glyph_position.x, glyph_position.y - glyph.metrics.ascent}, {glyph.rect.w, glyph.rect.h} }, color);
-            glyph_position.x += glyph.metrics.advance;
+            // looked up now rather than when shaped, so restored atlases are picked up
+            const auto& glyph = glyphs[text.glyphs[i]];
+            if (glyph.texture)
+                add_quad(glyph, static_cast<float>(glyph_position.x), static_cast<float>(glyph_position.y - glyph.metrics.ascent));
+            glyph_position.x += text.advances[i];
         }
 
         remaining_width -= it->advance;
     }
+
+    for (auto& [texture, indices] : page_indices)
+    {
+        layout.runs.push_back({ texture, static_cast<int>(layout.indices.size()), static_cast<int>(indices.size()) });
+        layout.indices.insert(layout.indices.end(), indices.begin(), indices.end());
+    }
+
+    return layout;
 }
 
 void TextRenderer::ClearAll()
 {
-    auto lc = std::scoped_lock(glyph_generation);
+    auto lc = lock_generation();
+
+    for (auto& rasterizer : rasterizers)
+    {
+        auto rasterizer_lc = std::scoped_lock(rasterizer->mtx);
+        rasterizer->fonts.clear();
+    }
+
+    {
+        std::scoped_lock shaping_lc{ shaping_mtx };
+        shaped_texts.clear();
+        shaped_index.clear();
+        shaped_bytes = 0;
+    }
 
     glyphs.clear();
-    atlases.clear();
+    pages.clear();
+    atlas_pages = 0;
+    atlas_used_area = 0;
+    ++atlas_generation;
+}
+
+void TextRenderer::RestoreAtlases()
+{
+    auto lc = lock_generation();
+
+    std::unordered_map<SDL_Texture*, SDL_Texture*> restored;
+    for (auto& page : pages)
+    {
+        auto texture = g_Renderer.CreateStaticTexture(page.shadow.get());
+        g_TextureManager.Register(texture.get(), TextureManager::Category::GlyphAtlas);
+        restored.emplace(page.texture.get(), texture.get());
+        page.texture = std::move(texture);
+    }
+
+    for (GlyphTable::id_t id = 0; id < glyphs.size(); ++id)
+        glyphs.at(id).texture = restored[glyphs.at(id).texture];
+
+    ++atlas_generation;
+    spdlog::info("TextRenderer: {} atlas pages restored", restored.size());
 }
 
-std::vector<Glyph> TextRenderer::transform_to_glyphs(std::u32string_view text, const std::vector<TTF_Font*>& fonts)
+auto TextRenderer::transform_to_glyphs(std::u32string_view text, const FontManager::ResolvedChain& chain) -> std::vector<GlyphTable::id_t>
 {
-    std::vector<Glyph> glyphs;
-    std::transform(text.begin(), text.end(), std::back_inserter(glyphs), [&, this](char32_t code_point) {
-        if (code_point > std::numeric_limits<char16_t>::max())
-            code_point = 0xFFFD;
+    std::vector<GlyphRequest> requests;
+    requests.reserve(text.size());
+    std::transform(text.begin(), text.end(), std::back_inserter(requests), [&chain](char32_t code_point) {
+        const auto font = chain.select(code_point);
+        return GlyphRequest{ chain.fonts[font], chain.font_ids[font], code_point };
+    });
+
+    std::vector<GlyphTable::id_t> ids;
+    ids.reserve(requests.size());
+    std::transform(requests.begin(), requests.end(), std::back_inserter(ids), [this](const GlyphRequest& request) {
+        return glyphs.find(request.font_id, request.code_point);
+    });
+
+    // all glyphs missing from the cache are generated as one batch
+    std::vector<GlyphRequest> missing;
+    for (size_t i = 0; i < requests.size(); ++i)
+    {
+        if (ids[i] == GlyphTable::invalid_id && std::find(missing.begin(), missing.end(), requests[i]) == missing.end())
+            missing.push_back(requests[i]);
+    }
+    glyph_misses += missing.size();
+    glyph_hits += requests.size() - missing.size();
+
+    if (missing.size())
+    {
+        generate_glyphs(missing);
+        for (size_t i = 0; i < requests.size(); ++i)
+        {
+            if (ids[i] == GlyphTable::invalid_id)
+                ids[i] = glyphs.find(requests[i].font_id, requests[i].code_point);
+        }
+    }
+
+    return ids;
+}
+
+void TextRenderer::generate_glyphs(const std::vector<GlyphRequest>& missing)
+{
+    // a handful of glyphs isn't worth a hand-off to another thread
+    constexpr size_t min_batch_size = 8;
+    const auto batches = std::clamp<size_t>(missing.size() / min_batch_size, 1, rasterizers.size());
+    const auto batch_size = (missing.size() + batches - 1) / batches;
+    const auto first_rasterizer = next_rasterizer.fetch_add(batches);
+
+    auto batch_of = [&](size_t index) {
+        auto first = std::min(missing.size(), index * batch_size);
+        return std::span{ missing }.subspan(first, std::min(batch_size, missing.size() - first));
+    };
+    auto rasterizer_of = [&](size_t index) -> Rasterizer& {
+        return *rasterizers[(first_rasterizer + index) % rasterizers.size()];
+    };
+
+    std::vector<pplx::task<std::vector<RasterizedGlyph>>> tasks;
+    for (size_t i = 1; i < batches; ++i)
+    {
+        tasks.push_back(pplx::create_task([this, requests = batch_of(i), &rasterizer = rasterizer_of(i)] {
+            return rasterize(requests, rasterizer);
+        }));
+    }
+
+    // calling thread takes the first batch
+    auto rasterized = rasterize(batch_of(0), rasterizer_of(0));
+    for (auto& task : tasks)
+    {
+        auto result = task.get();
+        std::move(result.begin(), result.end(), std::back_inserter(rasterized));
+    }
+
+    // text displayed on the render thread generates glyphs too, while other threads may hold the lock waiting for it
+    auto lc = lock_generation();
+
+    // region of every touched page covering its new glyphs, uploaded once below
+    std::unordered_map<size_t, SDL_Rect> dirty;
+    std::vector<std::pair<GlyphRequest, Glyph>> packed;
+    for (auto& glyph : rasterized)
+    {
+        const auto [font, font_id, code_point] = glyph.request;
+        if (glyphs.find(font_id, code_point) != GlyphTable::invalid_id)
+            continue; // generated by another thread meanwhile
+
+        if (glyph.surface == nullptr)
+        {
+            spdlog::warn("Could not render codepoint {}: {}", static_cast<uint32_t>(code_point), TTF_GetError());
+            glyphs.insert(font_id, code_point, Glyph{ nullptr, {}, glyph.metrics, font, code_point });
+            continue;
+        }
+
+        auto [page, glyph_position] = allocate_glyph(glyph.surface->w, glyph.surface->h);
+
+        auto shadow_position = glyph_position;
+        SDL_SetSurfaceBlendMode(glyph.surface.get(), SDL_BLENDMODE_NONE);
+        SDL_BlitSurface(glyph.surface.get(), nullptr, page.shadow.get(), &shadow_position);
+
+        if (auto [it, inserted] = dirty.try_emplace(static_cast<size_t>(&page - pages.data()), glyph_position); !inserted)
+        {
+            auto region = it->second;
+            SDL_UnionRect(&region, &glyph_position, &it->second);
+        }
 
-        auto it = std::find_if(fonts.begin(), fonts.end(), [code_point](auto font) {
-            return TTF_GlyphIsProvided(font, static_cast<uint16_t>(code_point));
-        });
-        if (it == fonts.end())
-            --it; // just use the last font even if it's missing the glyph
+        packed.emplace_back(glyph.request, Glyph{ page.texture.get(), glyph_position, glyph.metrics, font, code_point });
+    }
+
+    if (dirty.empty())
+        return;
 
-        auto font = *it;
-        return get_glyph(font, static_cast<uint16_t>(code_point));
+    g_RendererQueue.invoke([&](GuardedRenderer* g_Renderer) {
+        for (const auto& [page, region] : dirty)
+            g_Renderer->UpdateTexture(pages[page].texture.get(), &region, pages[page].shadow.get());
     });
 
-    return glyphs;
+    // readers can only see glyphs once their pixels are on the texture
+    for (const auto& [request, glyph] : packed)
+        glyphs.insert(request.font_id, request.code_point, glyph);
+}
+
+auto TextRenderer::lock_generation() -> std::unique_lock<std::mutex>
+{
+    if (!g_RendererQueue.on_render_thread())
+        return std::unique_lock(glyph_generation);
+
+    auto lc = std::unique_lock(glyph_generation, std::defer_lock);
+    while (!lc.try_lock())
+        g_RendererQueue.execute_one(g_Renderer);
+    return lc;
+}
+
+auto TextRenderer::rasterize(std::span<const GlyphRequest> requests, Rasterizer& rasterizer) -> std::vector<RasterizedGlyph>
+{
+    auto lc = std::scoped_lock(rasterizer.mtx);
+
+    std::vector<RasterizedGlyph> rasterized;
+    rasterized.reserve(requests.size());
+    for (const auto& request : requests)
+    {
+        const auto [font, font_id, code_point] = request;
+        auto& private_font = rasterizer.fonts[font];
+        if (private_font == nullptr)
+            private_font = g_FontManager.open_copy(font);
+        if (private_font == nullptr)
+        {
+            // e.g. the font file went away, without a surface generate_glyphs stores the glyph as missing
+            spdlog::warn("TextRenderer: could not open a copy of font {} {}", TTF_FontFaceFamilyName(font), TTF_FontFaceStyleName(font));
+            rasterized.push_back({ request, nullptr, {} });
+            continue;
+        }
+
+        auto metrics = Glyph::Metrics{ .height = TTF_FontHeight(private_font.get()), .ascent = TTF_FontAscent(private_font.get()), .descent = TTF_FontDescent(private_font.get()), .line_skip = TTF_FontLineSkip(private_font.get()) };
+        if (TTF_GlyphMetrics32(private_font.get(), code_point, &metrics.minx, &metrics.maxx, &metrics.miny, &metrics.maxy, &metrics.advance))
+        {
+            spdlog::info("Font {} {} doesn't have codepoint {}", TTF_FontFaceFamilyName(font), TTF_FontFaceStyleName(font), static_cast<uint32_t>(code_point));
+        }
+
+        auto surface = std::unique_ptr<SDL_Surface>(TTF_RenderGlyph32_Blended(private_font.get(), code_point, { 255, 255, 255, 255 }));
+        rasterized.push_back({ request, std::move(surface), metrics });
+    }
+
+    return rasterized;
+}
+
+bool TextRenderer::LoadCache(const std::filesystem::path& path)
+{
+    cache_path = path;
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto file = MappedFile{ path };
+    if (!file)
+    {
+        spdlog::info("TextRenderer: no glyph cache at {}", path.string());
+        return false;
+    }
+
+    auto corrupted = [&path] {
+        spdlog::warn("TextRenderer: glyph cache {} is corrupted", path.string());
+        return false;
+    };
+
+    auto reader = CacheReader{ file.bytes() };
+    auto header = CacheHeader{};
+    if (!reader.read(header) || header.magic != cache_magic || header.version != cache_version || header.page_size != AtlasPage::size)
+    {
+        spdlog::info("TextRenderer: glyph cache {} has a different format", path.string());
+        return false;
+    }
+
+    std::vector<std::pair<TTF_Font*, GlyphTable::font_id_t>> fonts;
+    for (uint32_t i = 0; i < header.fonts; ++i)
+    {
+        auto cached = CachedFont{};
+        auto name = std::string{};
+        if (!reader.read(cached) || cached.name_length > reader.remaining())
+            return corrupted();
+        name.resize(cached.name_length);
+        if (!reader.read(name.data(), name.size()))
+            return corrupted();
+
+        auto font = g_FontManager.get_font(name, cached.size);
+        if (font == nullptr || g_FontManager.get_file_hash(font) != cached.file_hash)
+        {
+            spdlog::info("TextRenderer: glyph cache is stale, font {} has changed", name);
+            return false;
+        }
+        fonts.emplace_back(font, g_FontManager.get_font_id(font));
+    }
+
+    if (header.glyphs > reader.remaining() / sizeof(CachedGlyph))
+        return corrupted();
+    auto cached_glyphs = std::vector<CachedGlyph>(header.glyphs);
+    if (!reader.read(cached_glyphs.data(), cached_glyphs.size() * sizeof(CachedGlyph)))
+        return corrupted();
+    for (const auto& glyph : cached_glyphs)
+    {
+        if (glyph.font >= fonts.size() || (glyph.page != no_page && glyph.page >= header.pages))
+            return corrupted();
+        // drawn from the page as is, so it has to lie within it
+        const auto& rect = glyph.rect;
+        if (glyph.page != no_page && (rect.x < 0 || rect.y < 0 || rect.w < 0 || rect.h < 0 || rect.w > AtlasPage::size - rect.x || rect.h > AtlasPage::size - rect.y))
+            return corrupted();
+    }
+
+    // pages are uploaded whole, one texture creation each
+    std::vector<AtlasPage> loaded;
+    for (uint32_t i = 0; i < header.pages; ++i)
+    {
+        auto cached = CachedPage{};
+        if (!reader.read(cached) || cached.rows > AtlasPage::size || cached.segments == 0 || cached.segments > AtlasPage::size)
+            return corrupted();
+
+        auto skyline = std::vector<AtlasPage::Segment>(cached.segments);
+        if (!reader.read(skyline.data(), skyline.size() * sizeof(AtlasPage::Segment)))
+            return corrupted();
+        if (std::accumulate(skyline.begin(), skyline.end(), 0, [](int width, const AtlasPage::Segment& segment) { return width + segment.w; }) != AtlasPage::size)
+            return corrupted();
+
+        constexpr auto row_bytes = static_cast<size_t>(AtlasPage::size) * 4;
+        auto pixels = reader.take(cached.rows * row_bytes);
+        if (pixels.size() != cached.rows * row_bytes)
+            return corrupted();
+
+        auto shadow = std::unique_ptr<SDL_Surface>(SDL_CreateRGBSurfaceWithFormat(0, AtlasPage::size, AtlasPage::size, 32, SDL_PIXELFORMAT_ARGB8888));
+        for (uint32_t row = 0; row < cached.rows; ++row)
+            std::memcpy(static_cast<std::byte*>(shadow->pixels) + row * shadow->pitch, pixels.data() + row * row_bytes, row_bytes);
+
+        auto texture = g_Renderer.CreateStaticTexture(shadow.get());
+        g_TextureManager.Register(texture.get(), TextureManager::Category::GlyphAtlas);
+        loaded.emplace_back(std::move(texture), std::move(shadow)).skyline = std::move(skyline);
+    }
+
+    auto lc = lock_generation();
+    ASSERT(pages.empty() && glyphs.size() == 0, "Glyph cache must be loaded before any text is preprocessed");
+
+    pages = std::move(loaded);
+    atlas_pages = pages.size();
+    for (const auto& cached : cached_glyphs)
+    {
+        auto [font, font_id] = fonts[cached.font];
+        auto texture = cached.page != no_page ? pages[cached.page].texture.get() : nullptr;
+        glyphs.insert(font_id, cached.code_point, Glyph{ texture, cached.rect, cached.metrics, font, static_cast<char32_t>(cached.code_point) });
+        atlas_used_area += static_cast<size_t>(cached.rect.w) * cached.rect.h;
+    }
+
+    spdlog::info("TextRenderer: {} glyphs on {} atlas pages loaded from {} in {} ms", glyphs.size(), pages.size(), path.string(),
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+    return true;
 }
 
-Glyph TextRenderer::get_glyph(TTF_Font* font, char16_t code_point)
+void TextRenderer::SaveCache()
 {
-    if (auto it = glyphs.find(std::make_pair(font, code_point)); it != glyphs.end())
-        return it->second;
+    if (cache_path.empty())
+        return;
+
+    // prewarming may be waiting for the render queue, which is served by this thread
+    if (prewarming != pplx::task<void>{})
+    {
+        while (!prewarming.is_done())
+            g_RendererQueue.execute_one(g_Renderer);
+    }
+
+    auto lc = lock_generation();
+
+    std::unordered_map<const SDL_Texture*, uint32_t> page_indices;
+    for (uint32_t i = 0; i < pages.size(); ++i)
+        page_indices.emplace(pages[i].texture.get(), i);
 
-    return generate_glyph(font, code_point);
+    std::unordered_map<const TTF_Font*, uint32_t> font_indices;
+    std::vector<std::pair<CachedFont, std::string>> fonts;
+    std::vector<CachedGlyph> cached_glyphs;
+    cached_glyphs.reserve(glyphs.size());
+    for (GlyphTable::id_t id = 0; id < glyphs.size(); ++id)
+    {
+        const auto& glyph = glyphs[id];
+
+        auto font_index = font_indices.find(glyph.font);
+        if (font_index == font_indices.end())
+        {
+            auto source = g_FontManager.get_name_and_size(glyph.font);
+            if (!source)
+                continue;
+
+            auto& [name, size] = *source;
+            fonts.push_back({ CachedFont{ g_FontManager.get_file_hash(glyph.font), size, static_cast<uint32_t>(name.size()) }, name });
+            font_index = font_indices.emplace(glyph.font, static_cast<uint32_t>(fonts.size() - 1)).first;
+        }
+
+        auto page = page_indices.find(glyph.texture);
+        cached_glyphs.push_back({ font_index->second, static_cast<uint32_t>(glyph.code_point), page != page_indices.end() ? page->second : no_page, glyph.rect, glyph.metrics });
+    }
+
+    std::error_code error;
+    if (cache_path.has_parent_path())
+        std::filesystem::create_directories(cache_path.parent_path(), error);
+
+    // written aside and moved over, so an interrupted save never leaves a broken cache behind
+    auto temporary = cache_path;
+    temporary += ".tmp";
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        write(out, CacheHeader{ cache_magic, cache_version, AtlasPage::size, static_cast<uint32_t>(fonts.size()), static_cast<uint32_t>(cached_glyphs.size()), static_cast<uint32_t>(pages.size()) });
+
+        for (const auto& [font, name] : fonts)
+        {
+            write(out, font);
+            out.write(name.data(), name.size());
+        }
+
+        out.write(reinterpret_cast<const char*>(cached_glyphs.data()), cached_glyphs.size() * sizeof(CachedGlyph));
+
+        for (const auto& page : pages)
+        {
+            // rows above the skyline are still empty
+            auto rows = std::max_element(page.skyline.begin(), page.skyline.end(), [](const auto& a, const auto& b) { return a.y < b.y; })->y;
+            write(out, CachedPage{ static_cast<uint32_t>(rows), static_cast<uint32_t>(page.skyline.size()) });
+            out.write(reinterpret_cast<const char*>(page.skyline.data()), page.skyline.size() * sizeof(AtlasPage::Segment));
+            for (int row = 0; row < rows; ++row)
+                out.write(static_cast<const char*>(page.shadow->pixels) + row * page.shadow->pitch, static_cast<std::streamsize>(AtlasPage::size) * 4);
+        }
+
+        if (!out)
+        {
+            spdlog::warn("TextRenderer: could not write glyph cache {}", temporary.string());
+            return;
+        }
+    }
+
+    std::filesystem::rename(temporary, cache_path, error);
+    if (error)
+    {
+        spdlog::warn("TextRenderer: could not replace glyph cache {}: {}", cache_path.string(), error.message());
+        return;
+    }
+
+    spdlog::info("TextRenderer: {} glyphs on {} atlas pages saved to {}", cached_glyphs.size(), pages.size(), cache_path.string());
 }
 
-Glyph TextRenderer::generate_glyph(TTF_Font* font, char16_t code_point)
+void TextRenderer::Prewarm(std::vector<TextStyle> styles)
 {
-    auto lc = std::scoped_lock(glyph_generation);
+    prewarming = pplx::create_task([this, styles = std::move(styles)] {
+        const auto start = std::chrono::steady_clock::now();
+        const auto text = common_characters();
+        for (const auto& style : styles)
+            PreprocessText(text, style);
+
+        spdlog::info("TextRenderer: {} glyphs prewarmed in {} ms", glyphs.size(),
+            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count());
+    });
+}
+
+void TextRenderer::SetShapingBudget(size_t bytes)
+{
+    std::scoped_lock lc{ shaping_mtx };
+    shaping_budget = bytes;
+}
 
-    auto surface = std::unique_ptr<SDL_Surface>(TTF_RenderGlyph_Blended(font, code_point, { 255, 255, 255, 255 }));
-    auto& atlas = get_atlas(surface->h, surface->w);
+auto TextRenderer::GetStatistics() const -> Statistics
+{
+    const auto pages_count = atlas_pages.load();
+    const auto page_area = static_cast<double>(AtlasPage::size) * AtlasPage::size;
 
-    auto glyph_position = SDL_Rect{ atlas.used, 0, surface->w, surface->h };
-    g_RendererQueue.push([&](GuardedRenderer* g_Renderer) {
-        g_Renderer->CopySurfaceToTexture(surface.get(), atlas.texture.get(), nullptr, &glyph_position);
-    }).wait();
+    std::scoped_lock lc{ shaping_mtx };
+    return {
+        .glyph_hits = glyph_hits,
+        .glyph_misses = glyph_misses,
+        .glyphs = glyphs.size(),
+        .atlas_pages = pages_count,
+        .atlas_fill = pages_count ? atlas_used_area / (pages_count * page_area) : 0.,
+        .shaped_hits = shaped_hits,
+        .shaped_misses = shaped_misses,
+        .shaped_entries = shaped_texts.size(),
+        .shaped_bytes = shaped_bytes,
+    };
+}
 
-    atlas.used += surface->w;
+auto TextRenderer::allocate_glyph(int w, int h) -> std::pair<AtlasPage&, SDL_Rect>
+{
+    ASSERT(w + AtlasPage::padding <= AtlasPage::size && h + AtlasPage::padding <= AtlasPage::size, "Glyph doesn't fit in an atlas page");
 
-    auto metrics = Glyph::Metrics{ .height = TTF_FontHeight(font), .ascent = TTF_FontAscent(font), .descent = TTF_FontDescent(font), .line_skip = TTF_FontLineSkip(font) };
-    if (TTF_GlyphMetrics(font, code_point, &metrics.minx, &metrics.maxx, &metrics.miny, &metrics.maxy, &metrics.advance))
+    // older pages are revisited, small glyphs often still fit in gaps left there
+    auto rect = SDL_Rect{};
+    for (auto& page : pages)
     {
-        spdlog::info("Font {} {} doesn't have codepoint {}", TTF_FontFaceFamilyName(font), TTF_FontFaceStyleName(font), static_cast<uint16_t>(code_point));
+        if (page.allocate(w, h, rect))
+        {
+            atlas_used_area += static_cast<size_t>(w) * h;
+            return { page, rect };
+        }
     }
 
-    return glyphs.emplace(std::make_pair(font, code_point), Glyph{ atlas.texture.get(), glyph_position, metrics, font, code_point }).first->second;
+    // static texture survives render target resets, shadow is zero-initialised, i.e. fully transparent
+    auto shadow = std::unique_ptr<SDL_Surface>(SDL_CreateRGBSurfaceWithFormat(0, AtlasPage::size, AtlasPage::size, 32, SDL_PIXELFORMAT_ARGB8888));
+    auto texture = g_Renderer.CreateStaticTexture(shadow.get());
+    g_TextureManager.Register(texture.get(), TextureManager::Category::GlyphAtlas);
+    auto& page = pages.emplace_back(std::move(texture), std::move(shadow));
+    ++atlas_pages;
+
+    spdlog::debug("TextRenderer: atlas page {} created, {:.1f}% of previous pages filled", pages.size(), GetStatistics().atlas_fill * 100.);
+
+    page.allocate(w, h, rect);
+    atlas_used_area += static_cast<size_t>(w) * h;
+    return { page, rect };
 }
 
-TextRenderer::Atlas& TextRenderer::get_atlas(int height, int width)
+bool TextRenderer::AtlasPage::allocate(int w, int h, SDL_Rect& rect)
 {
-    auto& size_group = atlases.try_emplace(height, 0).first->second;
+    const auto padded_w = w + padding;
+    const auto padded_h = h + padding;
+
+    // bottom-left rule: lowest resulting top edge wins, ties go to the narrowest segment to keep wide gaps open
+    auto best = skyline.end();
+    auto best_y = size;
+    auto best_w = size + 1;
+    for (auto it = skyline.begin(); it != skyline.end() && it->x + padded_w <= size; ++it)
+    {
+        // glyph rests on the highest segment it spans
+        auto y = 0;
+        auto remaining = padded_w;
+        for (auto span = it; remaining > 0; ++span)
+        {
+            y = std::max(y, span->y);
+            remaining -= span->w;
+        }
 
-    if (size_group.size() == 0 || size_group.back().available() < width)
+        if (y + padded_h > size)
+            continue;
+
+        if (y < best_y || (y == best_y && it->w < best_w))
+        {
+            best = it;
+            best_y = y;
+            best_w = it->w;
+        }
+    }
+
+    if (best == skyline.end())
+        return false;
+
+    rect = { best->x, best_y, w, h };
+
+    // raise the skyline under the glyph, then trim or drop segments it now covers
+    auto raised = skyline.insert(best, Segment{ rect.x, best_y + padded_h, padded_w });
+    auto right = rect.x + padded_w;
+    auto next = std::next(raised);
+    while (next != skyline.end() && next->x < right)
     {
-        auto texture = g_Renderer.CreateTexture(SDL_PIXELFORMAT_RGBA8888, SDL_TEXTUREACCESS_STATIC | SDL_TEXTUREACCESS_TARGET, 2000, height, { 0, 0, 0, 0 });
-        size_group.emplace_back(std::move(texture), 2000);
+        if (next->x + next->w <= right)
+        {
+            next = skyline.erase(next);
+            continue;
+        }
+        next->w -= right - next->x;
+        next->x = right;
+        break;
+    }
+
+    // merge neighbours of equal height so the scan stays short
+    for (auto it = skyline.begin(); it != skyline.end() && std::next(it) != skyline.end();)
+    {
+        if (auto following = std::next(it); it->y == following->y)
+        {
+            it->w += following->w;
+            skyline.erase(following);
+        }
+        else
+        {
+            ++it;
+        }
     }
 
-    return size_group.back();
+    return true;
 }
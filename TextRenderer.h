@@ -4,92 +4,227 @@
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <list>
 #include <mutex>
+#include <atomic>
+#include <span>
+#include <filesystem>
 
 #include <cpprest/details/basic_types.h>
+#include <pplx/pplxtasks.h>
 #include <SDL2/SDL_ttf.h>
 
 #include "Renderer.h"
+#include "GlyphTable.h"
+#include "FontManager.h"
 
 struct TextStyle
 {
-	std::vector<std::string> fonts;
+	FontChain fonts;
 	Renderer::Color color;
-	int size;
-};
-
-struct Glyph
-{
-	SDL_Texture* texture;
-	SDL_Rect rect;
-	struct Metrics {
-		int minx = 0, maxx = 0, miny = 0, maxy = 0, advance = 0;
-		int height = 0, ascent = 0, descent = 0, line_skip = 0;
-	} metrics;
-	TTF_Font* font;
-	char32_t code_point;
+	Renderer::Dimensions::Rem size;
 };
 
+// Glyphs [first, first + count) of a preprocessed text
 struct Word
 {
-	std::vector<Glyph> characters;
+	uint32_t first;
+	uint32_t count;
 	int width;
 	int advance;
 };
 
+// Shaped text as ids into the text renderer's glyph table, so a title takes a few small allocations
 struct PreprocessedText
 {
+	std::vector<GlyphTable::id_t> glyphs;
+	// per glyph, including kerning towards the following glyph
+	std::vector<int> advances;
 	std::vector<Word> words;
 	int line_height;
 };
 
-namespace std
+// Text wrapped into a box, one textured quad per glyph grouped by atlas page, ready to submit as is
+struct TextLayout
 {
-	template<> struct hash<std::pair<const TTF_Font*, char16_t>>
+	struct Run
 	{
-		std::size_t operator()(std::pair<const TTF_Font*, char16_t> const& s) const noexcept
-		{
-			auto ptr = reinterpret_cast<intptr_t>(s.first);
-			return ptr ^ (static_cast<intptr_t>(s.second) << 48 | static_cast<intptr_t>(s.second) << 32 | static_cast<intptr_t>(s.second) << 16 | s.second);
-		}
+		SDL_Texture* texture;
+		int first_index;
+		int index_count;
 	};
-}
+
+	// relative to the top left corner of the box
+	std::vector<SDL_Vertex> vertices;
+	std::vector<int> indices;
+	std::vector<Run> runs;
+
+	// what the layout was computed for
+	const PreprocessedText* source = nullptr;
+	Renderer::Dimensions::ActualPixelsSize size{ 0, 0 };
+	uint32_t generation = 0;
+
+	// vertices moved to where and how they were drawn last, reused while neither changes
+	std::vector<SDL_Vertex> placed;
+	Renderer::Dimensions::ActualPixelsPoint placed_at{ 0, 0 };
+	SDL_Color placed_color{ 0, 0, 0, 0 };
+
+	bool matches(const PreprocessedText& text, Renderer::Dimensions::ActualPixelsSize box, uint32_t atlas_generation) const
+	{
+		return source == &text && size.w == box.w && size.h == box.h && generation == atlas_generation;
+	}
+};
 
 class TextRenderer
 {
+public:
+	struct Statistics
+	{
+		uint64_t glyph_hits;
+		uint64_t glyph_misses;
+		size_t glyphs;
+		size_t atlas_pages;
+		// share of atlas page area covered by glyphs
+		double atlas_fill;
+		uint64_t shaped_hits;
+		uint64_t shaped_misses;
+		size_t shaped_entries;
+		size_t shaped_bytes;
+	};
+
+	static constexpr size_t default_shaping_budget = 8 * 1024 * 1024;
+
 private:
-	struct Atlas
+	// Square atlas page shared by all fonts and sizes, packed with a bottom-left skyline allocator
+	struct AtlasPage
 	{
+		static constexpr int size = 2048;
+		// empty pixels kept around every glyph, so filtering never samples a neighbour
+		static constexpr int padding = 1;
+
 		std::unique_ptr<SDL_Texture> texture;
-		const int capacity = 0;
-		int used = 0;
+		// CPU copy of the texture, so it can be restored without rasterizing glyphs again
+		std::unique_ptr<SDL_Surface> shadow;
+
+		// top edge of the packed area as horizontal segments, ordered by x and spanning the whole page
+		struct Segment
+		{
+			int x, y, w;
+		};
+		std::vector<Segment> skyline{ { 0, 0, size } };
+
+		AtlasPage(std::unique_ptr<SDL_Texture> _texture, std::unique_ptr<SDL_Surface> _shadow)
+			: texture{ std::move(_texture) }, shadow{ std::move(_shadow) } {};
 
-		Atlas(std::unique_ptr<SDL_Texture> _texture, int _capacity) : texture{ std::move(_texture) }, capacity{ _capacity } {};
-		int available() const { return capacity - used; }
+		// Reserves w×h pixels, returns false if they don't fit in this page
+		bool allocate(int w, int h, SDL_Rect& rect);
 
-		Atlas() = default;
-		Atlas(const Atlas&) = delete;
-		Atlas& operator=(const Atlas&) = delete;
-		Atlas(Atlas&& other) noexcept = default;
-		Atlas& operator=(Atlas&& other) noexcept = default;
+		AtlasPage(const AtlasPage&) = delete;
+		AtlasPage& operator=(const AtlasPage&) = delete;
+		AtlasPage(AtlasPage&& other) noexcept = default;
+		AtlasPage& operator=(AtlasPage&& other) noexcept = default;
+	};
+
+	// Private font handles of one rasterizing worker, FreeType faces can't be shared between threads
+	struct Rasterizer
+	{
+		std::mutex mtx;
+		std::unordered_map<const TTF_Font*, std::unique_ptr<TTF_Font>> fonts;
+	};
+
+	struct GlyphRequest
+	{
+		TTF_Font* font;
+		GlyphTable::font_id_t font_id;
+		char32_t code_point;
+
+		bool operator==(const GlyphRequest&) const = default;
+	};
+
+	struct RasterizedGlyph
+	{
+		GlyphRequest request;
+		std::unique_ptr<SDL_Surface> surface;
+		Glyph::Metrics metrics;
 	};
 
 public:
-	PreprocessedText PreprocessText(utf8string text, TextStyle style);
+	TextRenderer();
+
+	// Results are shared between identical requests and must not be modified
+	auto PreprocessText(const utf8string& text, const TextStyle& style) -> std::shared_ptr<const PreprocessedText>;
 	void Render(utf8string text, Renderer::Dimensions::ActualPixelsRectangle rect, TextStyle style);
 	void Render(const PreprocessedText& text, Renderer::Dimensions::ActualPixelsRectangle rect, Renderer::Color color);
+	void Render(TextLayout& layout, Renderer::Dimensions::ActualPixelsRectangle rect, Renderer::Color color);
+
+	// Wraps words into `size` and positions every glyph. Keep the result while text, size and generation stay the same.
+	auto Layout(const PreprocessedText& text, Renderer::Dimensions::ActualPixelsSize size) -> TextLayout;
 
 	void ClearAll();
 
+	// Recreates atlas textures from their shadow copies after the render device was reset.
+	// Glyphs already handed out refer to old textures, which is signalled by a new generation.
+	void RestoreAtlases();
+	auto generation() const -> uint32_t { return atlas_generation; }
+
+	// Restores atlas pages and glyphs saved by SaveCache. Must be called on the render thread before any text
+	// is preprocessed. Returns false when there is no usable cache, e.g. one of its font files has changed.
+	bool LoadCache(const std::filesystem::path& path);
+	// Writes the current atlas to the path given to LoadCache
+	void SaveCache();
+	// Preprocesses common characters in every style on a background task
+	void Prewarm(std::vector<TextStyle> styles);
+
+	// Memory for recently shaped texts, least recently used ones are dropped above it
+	void SetShapingBudget(size_t bytes);
+	auto GetStatistics() const -> Statistics;
+
+private:
+	struct ShapedText
+	{
+		uint64_t hash;
+		utf8string text;
+		FontChain fonts;
+		int size;
+		// glyphs refer to atlas textures, a new generation makes them stale
+		uint32_t generation;
+		std::shared_ptr<const PreprocessedText> shaped;
+		size_t bytes;
+	};
+
 private:
-	std::vector<Glyph> transform_to_glyphs(std::u32string_view text, const std::vector<TTF_Font*>& fonts);
-	Glyph get_glyph(TTF_Font* font, char16_t code_point);
-	Glyph generate_glyph(TTF_Font* font, char16_t code_point);
-	Atlas& get_atlas(int height, int width);
+	auto transform_to_glyphs(std::u32string_view text, const FontManager::ResolvedChain& chain) -> std::vector<GlyphTable::id_t>;
+	// Rasterizes glyphs on workers in parallel, then packs and uploads them in one go
+	void generate_glyphs(const std::vector<GlyphRequest>& missing);
+	auto rasterize(std::span<const GlyphRequest> requests, Rasterizer& rasterizer) -> std::vector<RasterizedGlyph>;
+	// Finds room for a w×h glyph, adding a page when all are full
+	auto allocate_glyph(int w, int h) -> std::pair<AtlasPage&, SDL_Rect>;
+	// Takes glyph_generation. The holder may be waiting for the render queue, so the render thread serves it meanwhile.
+	auto lock_generation() -> std::unique_lock<std::mutex>;
 
 private:
 	std::mutex glyph_generation;
-	std::unordered_map<std::pair<const TTF_Font*, char16_t>, Glyph> glyphs;
-	std::unordered_map<int, std::vector<Atlas>> atlases;
+	// written under glyph_generation, read without locking
+	GlyphTable glyphs;
+	std::vector<AtlasPage> pages;
+	std::vector<std::unique_ptr<Rasterizer>> rasterizers;
+	std::atomic<size_t> next_rasterizer{ 0 };
+	std::atomic<uint32_t> atlas_generation{ 0 };
+	std::atomic<uint64_t> glyph_hits{ 0 };
+	std::atomic<uint64_t> glyph_misses{ 0 };
+	std::atomic<size_t> atlas_pages{ 0 };
+	std::atomic<size_t> atlas_used_area{ 0 };
+
+	std::filesystem::path cache_path;
+	pplx::task<void> prewarming;
+
+	mutable std::mutex shaping_mtx;
+	// most recently used first
+	std::list<ShapedText> shaped_texts;
+	std::unordered_map<uint64_t, std::list<ShapedText>::iterator> shaped_index;
+	size_t shaped_bytes = 0;
+	size_t shaping_budget = default_shaping_budget;
+	std::atomic<uint64_t> shaped_hits{ 0 };
+	std::atomic<uint64_t> shaped_misses{ 0 };
 };
 
@@ -0,0 +1,164 @@
+#include "pch.h"
+
+#include "TextureManager.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "YouTubeCore.h"
+
+using namespace YouTube;
+
+void unregister_texture(SDL_Texture* texture) noexcept
+{
+	g_TextureManager.Unregister(texture);
+}
+
+void TextureManager::Register(SDL_Texture* texture, Category category, evictor_t evictor)
+{
+	if (texture == nullptr)
+		return;
+
+	std::scoped_lock lc{ mtx };
+
+	auto [it, inserted] = textures.try_emplace(texture, Entry{ texture_bytes(texture), category, frame, {} });
+	auto& entry = it->second;
+	if (!inserted)
+	{
+		usage.bytes[static_cast<size_t>(entry.category)] -= entry.bytes;
+		--usage.count[static_cast<size_t>(entry.category)];
+		entry.category = category;
+	}
+	else
+	{
+		usage.total += entry.bytes;
+	}
+	entry.evictor = std::move(evictor);
+
+	usage.bytes[static_cast<size_t>(category)] += entry.bytes;
+	++usage.count[static_cast<size_t>(category)];
+}
+
+void TextureManager::Unregister(SDL_Texture* texture) noexcept
+{
+	std::scoped_lock lc{ mtx };
+
+	if (auto it = textures.find(texture); it != textures.end())
+	{
+		usage.bytes[static_cast<size_t>(it->second.category)] -= it->second.bytes;
+		--usage.count[static_cast<size_t>(it->second.category)];
+		usage.total -= it->second.bytes;
+		textures.erase(it);
+	}
+}
+
+void TextureManager::Touch(SDL_Texture* texture)
+{
+	std::scoped_lock lc{ mtx };
+
+	if (auto it = textures.find(texture); it != textures.end())
+		it->second.last_drawn = frame;
+}
+
+void TextureManager::EndFrame()
+{
+	std::vector<evictor_t> evictors;
+	{
+		std::scoped_lock lc{ mtx };
+		++frame;
+
+		if (usage.total <= usage.budget)
+			return;
+
+		std::vector<const Entry*> candidates;
+		for (const auto& [texture, entry] : textures)
+		{
+			// textures drawn in the last frame are most likely on screen
+			if (entry.evictor && entry.last_drawn + 1 < frame)
+				candidates.push_back(&entry);
+		}
+		std::sort(candidates.begin(), candidates.end(), [](auto lhs, auto rhs) { return lhs->last_drawn < rhs->last_drawn; });
+
+		auto to_free = usage.total - usage.budget;
+		for (auto it = candidates.begin(); it != candidates.end() && to_free > 0; ++it)
+		{
+			evictors.push_back((*it)->evictor);
+			to_free -= std::min(to_free, (*it)->bytes);
+		}
+		usage.evictions += evictors.size();
+
+		if (evictors.empty())
+			spdlog::warn("TextureManager: {} MiB over budget with nothing to evict", (usage.total - usage.budget) / (1024 * 1024));
+	}
+
+	// evictors destroy textures, which unregisters them
+	for (auto& evictor : evictors)
+		evictor();
+
+	if (!evictors.empty())
+		Report();
+}
+
+void TextureManager::SetBudget(size_t bytes)
+{
+	std::scoped_lock lc{ mtx };
+	usage.budget = bytes;
+}
+
+auto TextureManager::GetUsage() const -> Usage
+{
+	std::scoped_lock lc{ mtx };
+	return usage;
+}
+
+void TextureManager::Report() const
+{
+	auto current = GetUsage();
+
+	std::string categories;
+	for (size_t i = 0; i < current.bytes.size(); ++i)
+	{
+		if (categories.size())
+			categories += ", ";
+		categories += fmt::format("{} {} ({} KiB)", current.count[i], category_name(static_cast<Category>(i)), current.bytes[i] / 1024);
+	}
+
+	spdlog::debug("TextureManager: {} of {} MiB used, {} evictions; {}",
+		current.total / (1024 * 1024), current.budget / (1024 * 1024), current.evictions, categories);
+}
+
+auto TextureManager::texture_bytes(SDL_Texture* texture) -> size_t
+{
+	Uint32 format;
+	int width, height;
+	if (SDL_QueryTexture(texture, &format, nullptr, &width, &height))
+		return 0;
+
+	const auto pixels = static_cast<size_t>(width) * height;
+	switch (format)
+	{
+	case SDL_PIXELFORMAT_YV12:
+	case SDL_PIXELFORMAT_IYUV:
+	case SDL_PIXELFORMAT_NV12:
+	case SDL_PIXELFORMAT_NV21:
+		return pixels * 3 / 2;
+	case SDL_PIXELFORMAT_YUY2:
+	case SDL_PIXELFORMAT_UYVY:
+	case SDL_PIXELFORMAT_YVYU:
+		return pixels * 2;
+	default:
+		return pixels * SDL_BYTESPERPIXEL(format);
+	}
+}
+
+auto TextureManager::category_name(Category category) -> const char*
+{
+	switch (category)
+	{
+	case Category::Thumbnail: return "thumbnails";
+	case Category::GlyphAtlas: return "glyph atlases";
+	case Category::VideoFrame: return "video frames";
+	case Category::Layer: return "layers";
+	default: return "other";
+	}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <unordered_map>
+#include <functional>
+#include <array>
+#include <mutex>
+#include <cstdint>
+
+#include <SDL2/SDL.h>
+
+// Accounts for every live texture by category and keeps total usage within a budget
+// by evicting least recently drawn textures that can be reloaded by their owners.
+class TextureManager
+{
+public:
+	enum class Category : uint8_t { Thumbnail, GlyphAtlas, VideoFrame, Layer, Other, Count };
+
+	// Releases owner's reference to the texture. Owner must be able to recreate it on demand.
+	using evictor_t = std::function<void()>;
+
+	struct Usage
+	{
+		std::array<size_t, static_cast<size_t>(Category::Count)> bytes{};
+		std::array<size_t, static_cast<size_t>(Category::Count)> count{};
+		size_t total = 0;
+		size_t budget = 0;
+		uint64_t evictions = 0;
+	};
+
+	static constexpr size_t default_budget = 256 * 1024 * 1024;
+
+public:
+	// Registers texture or updates category and evictor of already registered one
+	void Register(SDL_Texture* texture, Category category, evictor_t evictor = {});
+	void Unregister(SDL_Texture* texture) noexcept;
+
+	// Marks texture as drawn in current frame
+	void Touch(SDL_Texture* texture);
+
+	// Evicts reloadable textures over the budget. Call once per frame from the render thread.
+	void EndFrame();
+
+	void SetBudget(size_t bytes);
+	auto GetUsage() const -> Usage;
+	void Report() const;
+
+	static auto texture_bytes(SDL_Texture* texture) -> size_t;
+	static auto category_name(Category category) -> const char*;
+
+private:
+	struct Entry
+	{
+		size_t bytes;
+		Category category;
+		uint64_t last_drawn;
+		evictor_t evictor;
+	};
+
+	mutable std::mutex mtx;
+	std::unordered_map<SDL_Texture*, Entry> textures;
+	Usage usage{ .budget = default_budget };
+	uint64_t frame = 0;
+};
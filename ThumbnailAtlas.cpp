@@ -0,0 +1,175 @@
+#include "pch.h"
+
+#include "ThumbnailAtlas.h"
+
+#include <algorithm>
+#include <utility>
+
+#include "Deleters.h"
+#include "YouTubeCore.h"
+#include "TextureManager.h"
+
+using namespace YouTube;
+
+void ThumbnailAtlas::Batch::Add(const Image& image, SDL_Rect source, SDL_Rect destination)
+{
+	auto run = std::find_if(runs.begin(), runs.end(), [&](const Run& candidate) { return candidate.texture == image.texture.get(); });
+	if (run == runs.end())
+	{
+		int width = 0, height = 0;
+		SDL_QueryTexture(image.texture.get(), nullptr, nullptr, &width, &height);
+		run = runs.insert(runs.end(), Run{ image.texture.get(), static_cast<float>(width), static_cast<float>(height), {}, {} });
+	}
+
+	const auto left = (image.rect.x + source.x) / run->width;
+	const auto top = (image.rect.y + source.y) / run->height;
+	const auto right = (image.rect.x + source.x + source.w) / run->width;
+	const auto bottom = (image.rect.y + source.y + source.h) / run->height;
+	const auto x = static_cast<float>(destination.x), y = static_cast<float>(destination.y);
+	const auto w = static_cast<float>(destination.w), h = static_cast<float>(destination.h);
+	constexpr auto white = SDL_Color{ 255, 255, 255, 255 };
+
+	const auto first = static_cast<int>(run->vertices.size());
+	run->vertices.push_back({ { x, y }, white, { left, top } });
+	run->vertices.push_back({ { x + w, y }, white, { right, top } });
+	run->vertices.push_back({ { x, y + h }, white, { left, bottom } });
+	run->vertices.push_back({ { x + w, y + h }, white, { right, bottom } });
+	for (auto index : { 0, 1, 2, 2, 1, 3 })
+		run->indices.push_back(first + index);
+}
+
+void ThumbnailAtlas::Batch::Draw()
+{
+	for (const auto& run : runs)
+		g_Renderer.RenderGeometry(run.texture, run.vertices.data(), static_cast<int>(run.vertices.size()), run.indices.data(), static_cast<int>(run.indices.size()));
+	runs.clear();
+}
+
+auto ThumbnailAtlas::Insert(SDL_Surface* surface) -> image_ptr
+{
+	const auto columns = (max_page_size + padding) / (surface->w + padding);
+	const auto max_rows = (max_page_size + padding) / (surface->h + padding);
+	if (columns * max_rows < 2)
+		return nullptr;
+
+	const auto key = static_cast<size_key>(surface->w) << 32 | static_cast<uint32_t>(surface->h);
+	auto lc = std::scoped_lock{ mtx };
+	auto& size = sizes[key];
+	auto& pages = size.pages;
+	size.last_insert = std::chrono::steady_clock::now();
+
+	// pages of a size are few, the first one with room is taken so later ones empty out and can be destroyed
+	auto page = std::find_if(pages.begin(), pages.end(), [](const Page& candidate) { return candidate.used < candidate.capacity(); });
+	if (page == pages.end())
+	{
+		// the first page holds two images, every further one doubles what the size has
+		auto rows = columns >= 2 ? 1 : 2;
+		for (const auto& existing : pages)
+			rows += existing.rows;
+		rows = std::min(rows, max_rows);
+
+		const auto width = columns * (surface->w + padding) - padding;
+		const auto height = rows * (surface->h + padding) - padding;
+		// static texture survives render target resets, the zeroed surface leaves padding transparent
+		auto blank = std::unique_ptr<SDL_Surface>(SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_ARGB8888));
+		auto texture = blank ? g_Renderer.CreateStaticTexture(blank.get()) : nullptr;
+		if (texture == nullptr)
+			return nullptr;
+
+		g_TextureManager.Register(texture.get(), TextureManager::Category::Thumbnail);
+		page = pages.insert(pages.end(), Page{ ++next_page, std::move(texture), columns, rows });
+		spdlog::debug("ThumbnailAtlas: page {} for {}x{} images, {} slots", page->id, surface->w, surface->h, page->capacity());
+	}
+
+	auto slot = 0;
+	if (!page->released.empty())
+	{
+		slot = page->released.back();
+		page->released.pop_back();
+		++reuses;
+	}
+	else
+	{
+		slot = page->fresh++;
+	}
+	++page->used;
+	++allocations;
+
+	const auto rect = SDL_Rect{ slot % page->columns * (surface->w + padding), slot / page->columns * (surface->h + padding), surface->w, surface->h };
+	g_Renderer.UpdateTexture(page->texture.get(), &rect, surface->pixels, surface->pitch);
+
+	// the image may be dropped on any thread, only the page's texture has to be destroyed on the render thread
+	return image_ptr{ new Image{ page->texture, rect }, [this, key, id = page->id, slot](const Image* image) {
+		delete image;
+		release(key, id, slot);
+	} };
+}
+
+void ThumbnailAtlas::Trim()
+{
+	const auto now = std::chrono::steady_clock::now();
+	auto lc = std::scoped_lock{ mtx };
+	for (auto& [key, size] : sizes)
+	{
+		// the spare page is the first empty one, so images keep being packed into the older pages. A size nothing was
+		// inserted for in a while, e.g. after the window was resized, gives it up.
+		auto spare = now - size.last_insert > spare_timeout;
+		std::erase_if(size.pages, [&spare](const Page& page) {
+			if (page.used > 0)
+				return false;
+			return std::exchange(spare, true);
+		});
+	}
+	std::erase_if(sizes, [](const auto& size) { return size.second.pages.empty(); });
+}
+
+void ThumbnailAtlas::Clear()
+{
+	auto lc = std::scoped_lock{ mtx };
+	sizes.clear();
+}
+
+auto ThumbnailAtlas::GetStatistics() const -> Statistics
+{
+	auto lc = std::scoped_lock{ mtx };
+	auto statistics = Statistics{ .allocations = allocations, .reuses = reuses };
+	size_t page_area = 0, used_area = 0, stranded = 0;
+	for (const auto& [key, size] : sizes)
+	{
+		const auto w = static_cast<int>(key >> 32), h = static_cast<int>(static_cast<uint32_t>(key));
+		const auto slot_area = static_cast<size_t>(w) * h;
+		for (const auto& page : size.pages)
+		{
+			page_area += static_cast<size_t>(page.columns * (w + padding) - padding) * (page.rows * (h + padding) - padding);
+			used_area += slot_area * page.used;
+
+			++statistics.pages;
+			statistics.slots += page.capacity();
+			statistics.used_slots += page.used;
+			if (page.used > 0)
+				stranded += page.capacity() - page.used;
+		}
+	}
+
+	statistics.page_bytes = page_area * SDL_BYTESPERPIXEL(SDL_PIXELFORMAT_ARGB8888);
+	statistics.occupancy = page_area ? static_cast<double>(used_area) / page_area : 0.;
+	statistics.fragmentation = statistics.slots ? static_cast<double>(stranded) / statistics.slots : 0.;
+	return statistics;
+}
+
+void ThumbnailAtlas::release(size_key key, uint64_t id, int slot)
+{
+	auto lc = std::scoped_lock{ mtx };
+	auto size = sizes.find(key);
+	if (size == sizes.end())
+		return;
+
+	// cleared meanwhile
+	auto& pages = size->second.pages;
+	auto page = std::find_if(pages.begin(), pages.end(), [id](const Page& candidate) { return candidate.id == id; });
+	if (page == pages.end())
+		return;
+
+	page->released.push_back(slot);
+	--page->used;
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+#include <SDL2/SDL.h>
+
+// Thumbnails decoded at the same size share pages of equal slots, so cards can be drawn from a few textures.
+// A released slot goes to the next image of that size. Pages of a size grow with the images it holds, each new one as
+// large as the ones before together, so memory stays close to what's used. Empty pages are destroyed, except for one
+// per size while images of that size keep being inserted.
+class ThumbnailAtlas
+{
+public:
+	// What an image is drawn from, a slot of a shared page or a texture of its own
+	struct Image
+	{
+		std::shared_ptr<SDL_Texture> texture;
+		SDL_Rect rect;
+	};
+	using image_ptr = std::shared_ptr<const Image>;
+
+	// Collects copies of images and draws those from the same texture with a single call
+	class Batch
+	{
+	public:
+		// Queues `source`, relative to the image, stretched over `destination`
+		void Add(const Image& image, SDL_Rect source, SDL_Rect destination);
+		// Draws and empties the batch, textures in the order they were first added
+		void Draw();
+
+	private:
+		struct Run
+		{
+			SDL_Texture* texture;
+			float width, height;
+			std::vector<SDL_Vertex> vertices;
+			std::vector<int> indices;
+		};
+
+		std::vector<Run> runs;
+	};
+
+	struct Statistics
+	{
+		size_t pages;
+		size_t slots;
+		size_t used_slots;
+		size_t page_bytes;
+		// share of page area covered by images
+		double occupancy;
+		// free slots of pages that still hold images, as a share of all slots. Their memory can't be returned.
+		double fragmentation;
+		uint64_t allocations;
+		// allocations served by a slot released before
+		uint64_t reuses;
+	};
+
+	static constexpr int max_page_size = 2048;
+	// how long a size keeps its spare page after its last insert
+	static constexpr std::chrono::seconds spare_timeout{ 10 };
+	// empty pixels kept between slots, so filtering never samples a neighbour
+	static constexpr int padding = 1;
+
+public:
+	// Copies the surface into a free slot for its size, adding a page when all are full. Returns nothing when it's
+	// too large to share a page with another image. Must be called on the render thread.
+	auto Insert(SDL_Surface* surface) -> image_ptr;
+	// Destroys empty pages but one per size still in use. Must be called on the render thread.
+	void Trim();
+	// Forgets every page, e.g. after the render device was reset. Slots released later are ignored.
+	void Clear();
+
+	auto GetStatistics() const -> Statistics;
+
+private:
+	struct Page
+	{
+		uint64_t id;
+		std::shared_ptr<SDL_Texture> texture;
+		int columns, rows;
+		// slots from `fresh` on were never used, released ones are listed in `released`
+		int fresh = 0;
+		std::vector<int> released;
+		int used = 0;
+
+		auto capacity() const { return columns * rows; }
+	};
+
+	// Slots of one image size, keyed by width and height
+	using size_key = uint64_t;
+
+	struct Size
+	{
+		std::vector<Page> pages;
+		std::chrono::steady_clock::time_point last_insert;
+	};
+
+private:
+	void release(size_key key, uint64_t id, int slot);
+
+private:
+	mutable std::mutex mtx;
+	std::unordered_map<size_key, Size> sizes;
+	uint64_t next_page = 0;
+	uint64_t allocations = 0;
+	uint64_t reuses = 0;
+};
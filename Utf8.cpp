@@ -0,0 +1,107 @@
+#include "pch.h"
+
+#include "Utf8.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define UTF8_SSE2 1
+#include <emmintrin.h>
+#else
+#define UTF8_SSE2 0
+#endif
+
+namespace
+{
+	constexpr char32_t replacement_character = 0xFFFD;
+
+	// Decodes the sequence at `it` and advances past it. On invalid input consumes the valid prefix, at least one byte.
+	inline char32_t decode_one(const unsigned char*& it, const unsigned char* end)
+	{
+		const auto lead = *it++;
+		if (lead < 0x80)
+			return lead;
+
+		// ranges of the first continuation byte exclude overlong forms, surrogates and values above U+10FFFF
+		int continuation_bytes;
+		char32_t code_point;
+		unsigned char lower = 0x80, upper = 0xBF;
+		if (lead >= 0xC2 && lead <= 0xDF)
+		{
+			continuation_bytes = 1;
+			code_point = lead & 0x1F;
+		}
+		else if (lead >= 0xE0 && lead <= 0xEF)
+		{
+			continuation_bytes = 2;
+			code_point = lead & 0x0F;
+			if (lead == 0xE0)
+				lower = 0xA0;
+			else if (lead == 0xED)
+				upper = 0x9F;
+		}
+		else if (lead >= 0xF0 && lead <= 0xF4)
+		{
+			continuation_bytes = 3;
+			code_point = lead & 0x07;
+			if (lead == 0xF0)
+				lower = 0x90;
+			else if (lead == 0xF4)
+				upper = 0x8F;
+		}
+		else
+		{
+			return replacement_character;
+		}
+
+		for (int i = 0; i < continuation_bytes; ++i)
+		{
+			if (it == end || *it < lower || *it > upper)
+				return replacement_character;
+			code_point = code_point << 6 | (*it++ & 0x3F);
+			lower = 0x80;
+			upper = 0xBF;
+		}
+		return code_point;
+	}
+}
+
+void decode_utf8(std::string_view text, std::u32string& out)
+{
+	// there are never more code points than bytes, growing only when needed keeps the buffer reusable
+	if (out.size() < text.size())
+		out.resize(text.size());
+
+	auto it = reinterpret_cast<const unsigned char*>(text.data());
+	const auto end = it + text.size();
+	auto dest = out.data();
+
+	while (it != end)
+	{
+#if UTF8_SSE2
+		const auto zero = _mm_setzero_si128();
+		while (end - it >= 16)
+		{
+			const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(it));
+			if (_mm_movemask_epi8(chunk) != 0)
+				break;
+
+			const auto low = _mm_unpacklo_epi8(chunk, zero);
+			const auto high = _mm_unpackhi_epi8(chunk, zero);
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dest), _mm_unpacklo_epi16(low, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 4), _mm_unpackhi_epi16(low, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 8), _mm_unpacklo_epi16(high, zero));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(dest + 12), _mm_unpackhi_epi16(high, zero));
+			it += 16;
+			dest += 16;
+		}
+#endif
+
+		// a block that isn't pure ASCII, or the tail, is decoded one sequence at a time
+		const auto block_end = std::min(end, it + 16);
+		while (it < block_end)
+			*dest++ = decode_one(it, end);
+	}
+
+	out.resize(static_cast<size_t>(dest - out.data()));
+}
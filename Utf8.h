@@ -0,0 +1,9 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Decodes UTF-8 into `out`, reusing its capacity. Invalid or truncated sequences become U+FFFD,
+// one per maximal invalid subpart as recommended by the Unicode standard. Pure ASCII runs
+// are widened 16 bytes at a time where SSE2 is available.
+void decode_utf8(std::string_view text, std::u32string& out);
@@ -8,6 +8,9 @@
 
 #include <spdlog/spdlog.h>
 
+#include "YouTubeCore.h"
+#include "ConnectionPool.h"
+
 using namespace std::string_literals;
 
 class YouTubeAPI
@@ -15,14 +18,14 @@ class YouTubeAPI
 public:
 	auto get(utility::string_t browseId, pplx::cancellation_token token = pplx::cancellation_token::none()) -> pplx::task<nlohmann::json>
 	{
-		return client.request(browse_request(browseId), token).then([](web::http::http_response response) {
+		return YouTube::g_ConnectionPool.Request(origin, browse_request(browseId), token).then([](web::http::http_response response) {
 			return nlohmann::json::parse(response.extract_utf8string().get());
 		});
 	}
 
 	auto get_continuation(utility::string_t continuation, pplx::cancellation_token token = pplx::cancellation_token::none()) -> pplx::task<nlohmann::json>
 	{
-		return client.request(continuation_request(continuation), token).then([](web::http::http_response response) {
+		return YouTube::g_ConnectionPool.Request(origin, continuation_request(continuation), token).then([](web::http::http_response response) {
 			return nlohmann::json::parse(response.extract_utf8string().get());
 		});
 	}
@@ -89,7 +92,8 @@ private:
 	}
 
 private:
-	web::http::client::http_client client{ U("https://www.youtube.com") };
+	// shares its connections with everything else talking to it
+	utility::string_t origin = U("https://www.youtube.com");
 
 	utility::string_t clientName = U("TVHTML5");
 	utility::string_t clientVersion = U("6.20180913");
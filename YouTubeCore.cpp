@@ -12,10 +12,13 @@
 #endif
 
 #include "Renderer.h"
+#include "TextureManager.h"
+#include "ConnectionPool.h"
 #include "ImageManager.h"
 #include "YouTubeAPI.h"
 #include "FontManager.h"
 #include "TextRenderer.h"
+#include "LayerCache.h"
 
 #include "YouTubeVideo.h"
 
@@ -30,10 +33,15 @@ namespace
 namespace YouTube
 {
 	GuardedRenderer g_Renderer;
+	// defined before every other texture owner, so it outlives them all
+	TextureManager g_TextureManager;
+	// outlives the managers and the API, which make requests through it
+	ConnectionPool g_ConnectionPool;
 	ImageManager g_ImageManager;
 	YouTubeAPI g_API;
 	FontManager g_FontManager;
 	TextRenderer g_TextRenderer;
+	LayerCache g_LayerCache;
 
 	std::vector<std::function<bool(SDL_KeyboardEvent)>> g_KeyboardCallbacks;
 	std::unique_ptr<YouTubeVideo> g_PlayingVideo;
@@ -41,7 +49,7 @@ namespace YouTube
 	Renderer::RenderQueue g_RendererQueue;
 }
 
-void YouTube::Initialize()
+void YouTube::Initialize(bool headless)
 {
 	ASSERT(window == nullptr, "Core systems are already initialized");
 
@@ -49,23 +57,38 @@ void YouTube::Initialize()
 	SetConsoleOutputCP(CP_UTF8);
 #endif
 
+	// the home feed and its thumbnails come first, their handshakes overlap with creating the window and loading fonts.
+	// Headless runs, e.g. benchmarks, stay offline.
+	if (!headless)
+		g_ConnectionPool.Preconnect({ U("https://www.youtube.com"), U("https://i.ytimg.com") });
+
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_TIMER))
 		throw runtime_error("Could not initialize SDL: "s + SDL_GetError());
 
 	if (TTF_Init() == -1)
 		throw runtime_error("Could not initialize TTF: "s + TTF_GetError());
 
-	window.reset(SDL_CreateWindow("YouTubeTV", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 1280, 720, SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_OPENGL));
+	if (headless)
+		SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
+
+	const auto window_flags = headless ? SDL_WINDOW_HIDDEN : SDL_WINDOW_SHOWN | SDL_WINDOW_RESIZABLE | SDL_WINDOW_OPENGL;
+	window.reset(SDL_CreateWindow("YouTubeTV", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, 1280, 720, window_flags));
 	if (window == nullptr)
 		throw runtime_error("Could not create windows: "s + SDL_GetError());
 
 	g_Renderer.Initialize(window.get());
 
 	g_FontManager.Initialize();
+	g_ImageManager.Initialize();
 }
 
 void YouTube::Shutdown()
 {
+	g_LayerCache.Clear();
+	g_TextRenderer.SaveCache();
+	g_ImageManager.SaveCache();
+	// closes rasterizer font copies, which must happen before TTF_Quit
+	g_TextRenderer.ClearAll();
 	g_FontManager.clear();
 
 	window.reset();
@@ -8,11 +8,14 @@
 #include <SDL2/SDL_events.h>
 
 class GuardedRenderer;
+class TextureManager;
 class ImageManager;
+class ConnectionPool;
 class YouTubeAPI;
 class FontManager;
 class YouTubeVideo;
 class TextRenderer;
+class LayerCache;
 
 namespace Renderer {
 	class RenderQueue;
@@ -22,14 +25,18 @@ namespace YouTube
 {
 	using namespace std;
 
-	void Initialize();
+	// Headless mode uses a hidden window with software renderer, e.g. for benchmarks
+	void Initialize(bool headless = false);
 	void Shutdown();
 
 	extern GuardedRenderer g_Renderer;
+	extern TextureManager g_TextureManager;
+	extern ConnectionPool g_ConnectionPool;
 	extern ImageManager g_ImageManager;
 	extern YouTubeAPI g_API;
 	extern FontManager g_FontManager;
 	extern TextRenderer g_TextRenderer;
+	extern LayerCache g_LayerCache;
 
 	extern Renderer::RenderQueue g_RendererQueue;
 
@@ -41,7 +48,7 @@ namespace YouTube
 	// Initialize() and Shutdown() before return.
 	struct YouTubeCoreRAII
 	{
-		YouTubeCoreRAII() { Initialize(); };
+		YouTubeCoreRAII(bool headless = false) { Initialize(headless); };
 		~YouTubeCoreRAII() { Shutdown(); }
 	};
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include "YouTubeUI.h"
 
 #include <variant>
+#include <optional>
 #include <utility>
 #include <algorithm>
 #include <numeric>
@@ -15,16 +16,46 @@
 #include "ImageManager.h"
 #include "YouTubeVideo.h"
 #include "TextRenderer.h"
+#include "LayerCache.h"
+#include "Layout.h"
+#include "TextureManager.h"
 
 using namespace Renderer::Dimensions;
+using namespace YouTube::UI::Layout;
 using namespace std::string_literals;
 
+namespace
+{
+	// Resolved once per resize by MainMenu::display, read by every element
+	Table layout;
+}
+
 namespace YouTube::UI
 {
 class HomeTab;
 class Shelf;
 class MediaItem;
 
+constexpr Renderer::Color background_colour = { 47, 47, 47 };
+
+// Styles shared by all elements of a kind, also used to prewarm the glyph cache
+const TextStyle shelf_title_style{
+	.fonts = { /*"Roboto Regular",*/ "Arial Regular", "Meiryo Regular" },
+	.size = 1.5_rem
+};
+const TextStyle card_title_style{
+	.fonts = { "Roboto Bold", "Arial Bold", "Meiryo Bold", "Roboto Regular", "Arial Regular", "Meiryo Regular" },
+	.size = 1.5_rem
+};
+const TextStyle card_secondary_style{
+	.fonts = { "Roboto Regular", "Arial Regular", "Meiryo Regular" },
+	.size = 1_rem
+};
+const TextStyle card_length_style{
+	.fonts = { "Roboto Bold", "Arial Bold", "Meiryo Bold", "Roboto Regular", "Arial Regular", "Meiryo Regular" },
+	.size = 0.875_rem
+};
+
 class Text
 {
 public:
@@ -51,9 +82,11 @@ private:
 	TextStyle font_style;
 
 	std::shared_ptr<SDL_Texture> title_texture;
-	PreprocessedText preprocessed_text;
+	std::shared_ptr<const PreprocessedText> preprocessed_text;
+	TextLayout text_layout;
 	ActualPixelsSize size;
 	int current_font_size{-1};
+	uint32_t current_generation{0};
 };
 
 class Thumbnail
@@ -70,16 +103,49 @@ public:
 	~Thumbnail()
 	{
 		ctx.cancel();
-		loading_task.wait();
+		if (loading()) loading_task.wait();
 	}
 
-	auto display(ActualPixelsRectangle clipping) -> ActualPixelsSize;
+	// Queues the image into `batch`, the caller draws it
+	auto display(ActualPixelsRectangle clipping, ThumbnailAtlas::Batch& batch) -> ActualPixelsSize;
+
+	// Thumbnail is usually drawn only through a cached layer, so this also marks its texture as still in use
+	auto version() const -> uintptr_t;
+
+	// Starts loading the image, or moves the pending load to `priority`. Lower priorities are fetched first.
+	void want(int priority);
+	// Cancels the pending load, a later want() or display starts it again
+	void release();
 
 private:
-	ImageManager::img_ptr thumbnail;
-	ActualPixelsSize size;
+	void load(int priority);
+	// Until its result has been taken by settle
+	bool loading() const { return loading_task != decltype(loading_task){}; }
+	// Takes the result of a finished load. Called on the render thread, so the load itself never touches the thumbnail.
+	void settle();
+	// The window grew since the image was requested
+	bool outgrown() const;
+	// The loaded image, the one it replaces or a preview of it while it downloads
+	auto current() const -> ImageManager::img_ptr;
 
-	pplx::task<void> loading_task;
+private:
+	// ImageManager owns the texture and may evict it, in which case it's loaded again on next display
+	std::weak_ptr<const ImageManager::Image> thumbnail;
+	// ImageManager drops the smaller image once a larger one is requested, it's kept here until that one is shown
+	ImageManager::img_ptr previous;
+	bool failed = false;
+	// sizes and urls offered by the feed, smallest first
+	std::vector<std::pair<ActualPixelsSize, std::string>> variants;
+	std::string url;
+	// url as ImageManager knows it
+	utility::string_t image_url;
+	// focused card size the image was requested for
+	ActualPixelsSize target;
+	// last one HomeTab asked for, loads started by display keep it
+	int priority = 0;
+
+	// nullopt when the load was cancelled, nullptr when it failed
+	pplx::task<std::optional<ImageManager::img_ptr>> loading_task;
 	pplx::cancellation_token_source ctx;
 };
 
@@ -125,6 +191,9 @@ public:
 
 	bool keyboard_callback(SDL_KeyboardEvent event);
 
+	// shelves below the displayed ones whose thumbnails are fetched ahead of time
+	static constexpr int prefetched_shelves = 2;
+
 	friend void swap(HomeTab& first, HomeTab& second)
 	{
 		std::scoped_lock lock{ first.shelfs_list_mtx, second.shelfs_list_mtx };
@@ -134,10 +203,15 @@ public:
 		swap(first.shelfs, second.shelfs);
 		swap(first.selected_shelf, second.selected_shelf);
 		swap(first.continuation_payload, second.continuation_payload);
+		swap(first.prioritized_focus, second.prioritized_focus);
+		swap(first.wanted_first, second.wanted_first);
+		swap(first.wanted_last, second.wanted_last);
 	}
 
 private:
 	void load_more_shelfs();
+	// Requests thumbnails of the displayed and prefetched shelves by distance from focus, cancels the rest
+	void prioritize_thumbnails(int displayed_shelves, int visible_items);
 
 	utf8string title;
 	std::vector<Shelf> shelfs;
@@ -145,6 +219,10 @@ private:
 	std::string continuation_payload;
 
 	int selected_shelf = 0;
+
+	// focus and shelves the thumbnails were last prioritized for
+	uint64_t prioritized_focus = 0;
+	int wanted_first = 0, wanted_last = 0;
 };
 
 class Shelf
@@ -170,15 +248,24 @@ public:
 
 	bool keyboard_callback(SDL_KeyboardEvent event);
 
+	// Requests thumbnails from a screen before to two screens after the selected item, `priority` plus the
+	// distance from it. Thumbnails that fell out of that range since the last call are released.
+	void prioritize_thumbnails(int priority, int visible_items);
+	void release_thumbnails();
+
 	friend void swap(Shelf& first, Shelf& second)
 	{
 		std::scoped_lock lock{ first.items_list_mtx, second.items_list_mtx };
 		swap(first.title, second.title);
 		swap(first.items, second.items);
 		swap(first.selected_item, second.selected_item);
+		swap(first.layer_id, second.layer_id);
+		swap(first.wanted_first, second.wanted_first);
+		swap(first.wanted_last, second.wanted_last);
 	}
 
 	auto size() const { return items.size(); }
+	auto focused() const { return selected_item; }
 
 private:
 	Text title;
@@ -186,6 +273,8 @@ private:
 	mutable std::mutex items_list_mtx;
 
 	int selected_item = 0;
+	LayerCache::id_t layer_id = LayerCache::NewId();
+	int wanted_first = 0, wanted_last = 0;
 };
 
 class MediaItem
@@ -206,16 +295,26 @@ protected:
 public:
 	static auto create(const nlohmann::json& data)->std::unique_ptr<MediaItem>;
 
+	// The card's layer leaves the thumbnail out, so that the thumbnails of a row can be drawn together
 	virtual auto display(ActualPixelsRectangle clipping, bool selected) -> ActualPixelsSize;
+	void display_thumbnail(ActualPixelsRectangle clipping, bool selected, ThumbnailAtlas::Batch& batch);
+	auto version(bool selected) const { return LayerCache::Combine(thumbnail.version(), selected); }
+
+	void want_thumbnail(int priority) { thumbnail.want(priority); }
+	void release_thumbnail() { thumbnail.release(); }
 
 	bool keyboard_callback(SDL_KeyboardEvent event);
 
+protected:
+	void draw_card(ActualPixelsRectangle layer, bool selected);
+
 protected:
 	Type type;
 	Text title;
 	Text secondary;
 	Thumbnail thumbnail;
 	utf8string video_id;
+	LayerCache::id_t layer_id = LayerCache::NewId();
 	//std::variant<ImageManager::img_ptr, pplx::task<void>> thumbnail;
 };
 
@@ -286,17 +385,22 @@ YouTube::UI::Text::Text(std::string text, TextStyle _font_style)
 
 auto YouTube::UI::Text::display(ActualPixelsRectangle clipping, Renderer::Color colour) -> ActualPixelsSize
 {
-	if (static_cast<int>(font_style.size) != current_font_size)
+	// font size follows rem, so only a resize that actually changes it needs new glyphs
+	if (static_cast<int>(font_style.size) != current_font_size || g_TextRenderer.generation() != current_generation)
 		render();
 
-	g_TextRenderer.Render(preprocessed_text, clipping, colour);
+	if (!text_layout.matches(*preprocessed_text, clipping.size, g_TextRenderer.generation()))
+		text_layout = g_TextRenderer.Layout(*preprocessed_text, clipping.size);
+	g_TextRenderer.Render(text_layout, clipping, colour);
 
 	return clipping.size;
 }
 
 void YouTube::UI::Text::render()
 {
+	current_generation = g_TextRenderer.generation();
 	preprocessed_text = g_TextRenderer.PreprocessText(text_str, font_style);
+	text_layout = {};
 	current_font_size = static_cast<int>(font_style.size);
 }
 
@@ -374,17 +478,30 @@ auto YouTube::UI::HomeTab::display(ActualPixelsRectangle clipping) -> ActualPixe
 {
 	g_KeyboardCallbacks.emplace_back(std::bind(&HomeTab::keyboard_callback, this, std::placeholders::_1));
 
-	g_Renderer.DrawBox(clipping, {47, 47, 47});
+	g_Renderer.DrawBox(clipping, background_colour);
 
+	const auto bottom = clipping.pos.y + clipping.size.h;
 	clipping.pos.y += display_top_navigation(clipping).h;
 
 	std::lock_guard lock{ shelfs_list_mtx };
-	for (int i = selected_shelf; i < shelfs.size(); ++i)
+	int displayed = 0;
+	for (int i = selected_shelf; i < shelfs.size() && clipping.pos.y < bottom; ++i, ++displayed)
 	{
 		auto& shelf = shelfs[i];
 		clipping.pos.y += shelf.display(clipping, i == selected_shelf).h;
 	}
 
+	const auto item_stride = layout[Box::ShelfItemStride].w;
+	const auto visible_items = (clipping.size.w - layout[Box::ShelfItems].x + item_stride - 1) / item_stride;
+	auto focus = LayerCache::Combine(LayerCache::Combine(selected_shelf, displayed), LayerCache::Combine(shelfs.size(), visible_items));
+	if (selected_shelf < shelfs.size())
+		focus = LayerCache::Combine(focus, shelfs[selected_shelf].focused());
+	if (focus != prioritized_focus)
+	{
+		prioritize_thumbnails(displayed, visible_items);
+		prioritized_focus = focus;
+	}
+
 	if (selected_shelf >= shelfs.size() - 2 && (loading_task == decltype(loading_task){} || loading_task.is_done()))
 	{
 		load_more_shelfs();
@@ -395,7 +512,7 @@ auto YouTube::UI::HomeTab::display(ActualPixelsRectangle clipping) -> ActualPixe
 
 auto YouTube::UI::HomeTab::display_top_navigation(ActualPixelsRectangle clipping) -> ActualPixelsSize
 {
-	clipping.size.h = 6.5_rem;
+	clipping.size.h = layout[Box::TopNavigation].h;
 	g_Renderer.DrawBox(clipping, {57, 57, 57});
 
 	return clipping.size;
@@ -416,6 +533,30 @@ bool YouTube::UI::HomeTab::keyboard_callback(SDL_KeyboardEvent event)
 	return false;
 }
 
+void YouTube::UI::HomeTab::prioritize_thumbnails(int displayed_shelves, int visible_items)
+{
+	// a shelf further down counts as a couple of items further aside, prefetched shelves come after everything on screen
+	constexpr int shelf_distance = 2;
+	constexpr int speculative = 1000;
+
+	const auto first = selected_shelf;
+	const auto last = std::min<int>(shelfs.size(), selected_shelf + displayed_shelves + prefetched_shelves);
+	for (int i = wanted_first; i < std::min<int>(wanted_last, shelfs.size()); ++i)
+	{
+		if (i < first || i >= last)
+			shelfs[i].release_thumbnails();
+	}
+
+	for (int i = first; i < last; ++i)
+	{
+		const auto offset = i - selected_shelf;
+		shelfs[i].prioritize_thumbnails(offset * shelf_distance + (offset >= displayed_shelves ? speculative : 0), visible_items);
+	}
+
+	wanted_first = first;
+	wanted_last = last;
+}
+
 void YouTube::UI::HomeTab::load_more_shelfs()
 {
 	if (continuation_payload == "") return;
@@ -445,14 +586,26 @@ YouTube::UI::MainMenu::MainMenu()
 	main_content = std::make_unique<HomeView>();
 }
 
+YouTube::UI::MainMenu::MainMenu(std::unique_ptr<BasicElement> content)
+	: main_content{ std::move(content) }
+{
+}
+
+auto YouTube::UI::make_home_tab(const nlohmann::json& data) -> std::unique_ptr<BasicElement>
+{
+	return std::make_unique<HomeTab>(data);
+}
+
+void YouTube::UI::prewarm_text()
+{
+	g_TextRenderer.Prewarm({ shelf_title_style, card_title_style, card_secondary_style, card_length_style });
+}
+
 YouTube::UI::Shelf::Shelf(const nlohmann::json& data)
 {
 	ASSERT(data.contains("shelfRenderer"));
 	const auto& shelf_renderer = data["shelfRenderer"];
-	title = Text{ build_text(shelf_renderer["headerRenderer"]["shelfHeaderRenderer"]["title"]), {
-		.fonts = { /*"Roboto Regular",*/ "Arial Regular", "Meiryo Regular" },
-		.size = static_cast<int>(1.5_rem)
-	} };
+	title = Text{ build_text(shelf_renderer["headerRenderer"]["shelfHeaderRenderer"]["title"]), shelf_title_style };
 
 	spdlog::info("Processing {} shelf", title.str());
 	for (const auto& item_data : shelf_renderer["content"]["horizontalListRenderer"]["items"])
@@ -468,25 +621,45 @@ YouTube::UI::Shelf::Shelf(const nlohmann::json& data)
 
 auto YouTube::UI::Shelf::display(ActualPixelsRectangle clipping, bool selected) -> ActualPixelsSize
 {
+	const auto shelf_size = layout[Box::ShelfRow].size();
+	const auto items_origin = layout[Box::ShelfItems];
+	const auto item_stride = layout[Box::ShelfItemStride].w;
+
+	std::lock_guard lock{ items_list_mtx };
 	if (selected)
+	{
 		g_KeyboardCallbacks.emplace_back(std::bind(&Shelf::keyboard_callback, this, std::placeholders::_1));
+		// the row may be composited from cache, so focused item's callback can't rely on its display()
+		if (selected_item < items.size())
+			g_KeyboardCallbacks.emplace_back(std::bind(&MediaItem::keyboard_callback, items[selected_item].get(), std::placeholders::_1));
+	}
 
-	clipping.pos.x += 3_rem;
-	clipping.pos.y += 0.125_rem /* half of line/font height diff */;
+	const auto first_item = std::max(selected_item - 1, 0);
+	const auto last_item = std::min<int>(items.size(), first_item + (clipping.size.w - items_origin.x + item_stride - 1) / item_stride);
 
-	title.display({ clipping.pos, {clipping.size.w, static_cast<int>(1.75_rem)} });
+	auto version = LayerCache::Combine(selected, selected_item);
+	for (int i = first_item; i < last_item; ++i)
+		version = LayerCache::Combine(version, items[i]->version(selected && i == selected_item));
 
-	clipping.pos.y += 1.5_rem /* font height */ + 0.125_rem /* half of line/font height diff */ + 1_rem /* margin-top of media item */;
+	clipping.size.h = shelf_size.h;
+	g_LayerCache.Draw(layer_id, version, clipping, background_colour, [&](ActualPixelsRectangle layer) {
+		auto title_rect = layout[Box::ShelfTitle].at(layer.pos);
+		title_rect.size.w = layer.size.w - title_rect.pos.x;
+		title.display(title_rect);
 
-	std::lock_guard lock{ items_list_mtx };
-	for (int i = std::max(selected_item - 1, 0); i < items.size(); ++i)
-	{
-		auto& item = items[i];
-		item->display(clipping, selected && i == selected_item);
-		clipping.pos.x += 22_rem;
-	}
+		layer.pos = items_origin.at(layer.pos).pos;
+		ThumbnailAtlas::Batch thumbnails;
+		for (int i = first_item; i < last_item; ++i)
+		{
+			items[i]->display(layer, selected && i == selected_item);
+			items[i]->display_thumbnail(layer, selected && i == selected_item, thumbnails);
+			layer.pos.x += item_stride;
+		}
+		// over the cards, one draw per atlas page rather than a texture switch per card
+		thumbnails.Draw();
+	});
 
-	return RemSize{0., 25.375};
+	return shelf_size;
 }
 
 bool YouTube::UI::Shelf::keyboard_callback(SDL_KeyboardEvent event)
@@ -504,9 +677,38 @@ bool YouTube::UI::Shelf::keyboard_callback(SDL_KeyboardEvent event)
 	return false;
 }
 
+void YouTube::UI::Shelf::prioritize_thumbnails(int priority, int visible_items)
+{
+	std::lock_guard lock{ items_list_mtx };
+	const auto first = std::max(selected_item - visible_items, 0);
+	const auto last = std::min<int>(items.size(), selected_item + 2 * visible_items);
+	for (int i = wanted_first; i < wanted_last; ++i)
+	{
+		if (i < first || i >= last)
+			items[i]->release_thumbnail();
+	}
+
+	for (int i = first; i < last; ++i)
+		items[i]->want_thumbnail(priority + std::abs(i - selected_item));
+
+	wanted_first = first;
+	wanted_last = last;
+}
+
+void YouTube::UI::Shelf::release_thumbnails()
+{
+	std::lock_guard lock{ items_list_mtx };
+	for (int i = wanted_first; i < wanted_last; ++i)
+		items[i]->release_thumbnail();
+
+	wanted_first = wanted_last = 0;
+}
+
 auto YouTube::UI::MainMenu::display(ActualPixelsRectangle clipping) -> ActualPixelsSize
 {
-	clipping.pos.x += 8.5_rem;
+	layout.Update();
+
+	clipping.pos.x += layout[Box::MainContent].x;
 
 	main_content->display(clipping);
 
@@ -547,28 +749,27 @@ auto YouTube::UI::MediaItem::create(const nlohmann::json& data) -> std::unique_p
 
 auto YouTube::UI::MediaItem::display(ActualPixelsRectangle clipping, bool selected) -> ActualPixelsSize
 {
-	if (selected)
-		g_KeyboardCallbacks.emplace_back(std::bind(&MediaItem::keyboard_callback, this, std::placeholders::_1));
-
-	const auto thumbnailrect = [clipping](bool selected) {
-		if (selected)
-			return RemRectangle{ clipping.pos - RemSize{0.5, 0.5}, RemSize{22, 12.25} };
-		else
-			return RemRectangle{ clipping.pos, RemSize{21, 11.75} };
-	}(selected);
+	// a loaded thumbnail doesn't change the card's own layer
+	g_LayerCache.Draw(layer_id, selected, layout[Box::Card].at(clipping.pos), background_colour, [&](ActualPixelsRectangle layer) {
+		draw_card(layer, selected);
+	});
 
-	thumbnail.display(thumbnailrect);
+	return ActualPixelsSize();
+}
 
-	clipping.pos.y += 11.75_rem;
+void YouTube::UI::MediaItem::display_thumbnail(ActualPixelsRectangle clipping, bool selected, ThumbnailAtlas::Batch& batch)
+{
+	const auto card = layout[Box::Card].at(clipping.pos).pos;
+	thumbnail.display(layout[selected ? Box::CardThumbnailFocused : Box::CardThumbnail].at(card), batch);
+}
 
+void YouTube::UI::MediaItem::draw_card(ActualPixelsRectangle layer, bool selected)
+{
 	if (selected)
-		g_Renderer.DrawBox(RemRectangle{ clipping.pos - RemSize{0.5, 0}, RemSize{22, 8.15 } }, { 235, 235, 235 });
-
-	clipping.pos.y += title.display({ clipping.pos, RemSize{21, 3.5} }, selected ? title.selected_colour : title.default_colour).y;
-	clipping.pos.y += 0.5_rem; /* title margin bottom */
-	secondary.display({ clipping.pos, RemSize{21, 1.25} });
+		g_Renderer.DrawBox(layout[Box::CardFocusedDetails].at(layer.pos), { 235, 235, 235 });
 
-	return ActualPixelsSize();
+	title.display(layout[Box::CardTitle].at(layer.pos), selected ? title.selected_colour : title.default_colour);
+	secondary.display(layout[Box::CardSecondary].at(layer.pos));
 }
 
 bool YouTube::UI::MediaItem::keyboard_callback(SDL_KeyboardEvent event)
@@ -585,67 +786,159 @@ bool YouTube::UI::MediaItem::keyboard_callback(SDL_KeyboardEvent event)
 YouTube::UI::MusicVideo::MusicVideo(const nlohmann::json& data)
 	: MediaItem(data)
 {
-	title = Text{ build_text(data.at("primaryText")), {
-		.fonts = { "Roboto Bold", "Arial Bold", "Meiryo Bold", "Roboto Regular", "Arial Regular", "Meiryo Regular" },
-		.size = static_cast<int>(1.5_rem)
-	} };
+	title = Text{ build_text(data.at("primaryText")), card_title_style };
 
-	secondary = Text{ build_text(data.at("secondaryText")) + " • " + build_text(data.at("tertiaryText")), {
-		.fonts = { "Roboto Regular", "Arial Regular", "Meiryo Regular" },
-		.size = static_cast<int>(1_rem)
-	} };
-	length_text = Text{ build_text(data.at("lengthText")), {
-		.fonts = { "Roboto Bold", "Arial Bold", "Meiryo Bold", "Roboto Regular", "Arial Regular", "Meiryo Regular" },
-		.size = static_cast<int>(0.875_rem)
-	} };
+	secondary = Text{ build_text(data.at("secondaryText")) + " • " + build_text(data.at("tertiaryText")), card_secondary_style };
+	length_text = Text{ build_text(data.at("lengthText")), card_length_style };
 }
 
 YouTube::UI::Video::Video(const nlohmann::json& data)
 	: MediaItem(data)
 {
-	title = Text{ build_text(data.at("title")), {
-		.fonts = { "Roboto Bold", "Arial Bold", "Meiryo Bold", "Roboto Regular", "Arial Regular", "Meiryo Regular" },
-		.size = static_cast<int>(1.5_rem)
-	} };
+	title = Text{ build_text(data.at("title")), card_title_style };
 
-	secondary = Text{ build_text(data.at("shortBylineText")) + " • " + build_text(data.at("shortViewCountText")) /*+ " • " + build_text(data.at("publishedTimeText"))*/, {
-		.fonts = { "Roboto Regular", "Arial Regular", "Meiryo Regular" },
-		.size = static_cast<int>(1_rem)
-	} };
-	length_text = Text{ build_text(data.at("lengthText")), {
-		.fonts = { "Roboto Bold", "Arial Bold", "Meiryo Bold", "Roboto Regular", "Arial Regular", "Meiryo Regular" },
-		.size = static_cast<int>(0.875_rem)
-	} };
+	secondary = Text{ build_text(data.at("shortBylineText")) + " • " + build_text(data.at("shortViewCountText")) /*+ " • " + build_text(data.at("publishedTimeText"))*/, card_secondary_style };
+	length_text = Text{ build_text(data.at("lengthText")), card_length_style };
 }
 
 YouTube::UI::Thumbnail::Thumbnail(const nlohmann::json& data)
 {
-	auto thumbnails = data["thumbnails"];
-	auto it = std::lower_bound(thumbnails.begin(), thumbnails.end(), Vec2D<int>{475, 264} /* max size on FullHD */, [](const nlohmann::json& lhs, const Vec2D<int>& rhs) {
-		return lhs["height"].get<int>() < rhs.h || lhs["width"].get<int>() < rhs.w;
+	for (const auto& variant : data["thumbnails"])
+		variants.emplace_back(ActualPixelsSize{ variant["width"].get<int>(), variant["height"].get<int>() }, variant["url"].get<std::string>());
+	// loaded once HomeTab asks for it or it's displayed, the variant depends on the window size by then
+}
+
+void YouTube::UI::Thumbnail::load(int priority)
+{
+	if (variants.empty())
+	{
+		failed = true;
+		return;
+	}
+
+	// reloaded for a larger window
+	if (auto image = thumbnail.lock())
+		previous = std::move(image);
+
+	// the focused card is the largest the thumbnail is drawn at
+	target = layout[Box::CardThumbnailFocused].size();
+	auto variant = std::find_if(variants.begin(), variants.end(), [this](const auto& candidate) {
+		return candidate.first.w >= target.w && candidate.first.h >= target.h;
 	});
+	if (variant == variants.end())
+		--variant; // get heightest even if not good enough
 
-	if (it == thumbnails.end())
-		--it; // get heightest even if not good enough
+	url = variant->second;
+	image_url = utility::conversions::to_string_t(url);
 
-	size = ActualPixelsSize{ it.value()["width"].get<int>(), it.value()["height"].get<int>() };
-	auto url = it.value()["url"].get<std::string>();
 	spdlog::info("Loading thumbnail: {}", url);
-	loading_task = g_ImageManager.get_image(utility::conversions::to_string_t(url), ctx.get_token())
-		.then([&, url](ImageManager::img_ptr image) {
-			//TODO: Check if image was loaded correctly and display a placeholder if not
-			thumbnail = image;
-			spdlog::info("Thumbnail {} loaded", url);
+	// a cancelled source stays cancelled
+	ctx = {};
+	loading_task = g_ImageManager.get_image(image_url, priority, ctx.get_token(), target)
+		.then([url = url](pplx::task<ImageManager::img_ptr> loaded) -> std::optional<ImageManager::img_ptr> {
+			try
+			{
+				return loaded.get();
+			}
+			catch (const pplx::task_canceled&)
+			{
+				return std::nullopt;
+			}
+			catch (const std::exception& e)
+			{
+				spdlog::warn("Thumbnail {} could not be loaded: {}", url, e.what());
+				return nullptr;
+			}
 		});
 }
 
-auto YouTube::UI::Thumbnail::display(ActualPixelsRectangle clipping) -> ActualPixelsSize
+void YouTube::UI::Thumbnail::settle()
 {
-	if (!thumbnail)
+	if (!loading() || !loading_task.is_done())
+		return;
+
+	auto loaded = std::exchange(loading_task, {}).get();
+	// released, loaded again once it's displayed
+	if (!loaded)
+		return;
+
+	//TODO: Check if image was loaded correctly and display a placeholder if not
+	// a reload for a larger window keeps showing the smaller image when it fails
+	failed = *loaded == nullptr;
+	if (*loaded)
+	{
+		thumbnail = *loaded;
+		spdlog::info("Thumbnail {} loaded", url);
+	}
+}
+
+bool YouTube::UI::Thumbnail::outgrown() const
+{
+	const auto wanted = layout[Box::CardThumbnailFocused].size();
+	return wanted.w > target.w || wanted.h > target.h;
+}
+
+auto YouTube::UI::Thumbnail::current() const -> ImageManager::img_ptr
+{
+	if (auto image = thumbnail.lock())
+		return image;
+	if (previous)
+		return previous;
+	// progressive images show their completed scans, the card shows through until the first one
+	return loading() ? g_ImageManager.GetPreview(image_url) : nullptr;
+}
+
+void YouTube::UI::Thumbnail::want(int _priority)
+{
+	priority = _priority;
+	settle();
+	if (loading())
+	{
+		// a released load is finishing its cancellation, display starts it again
+		if (!ctx.get_token().is_canceled())
+			g_ImageManager.Prioritize(image_url, priority);
+	}
+	else if (!failed && (thumbnail.expired() || outgrown()))
+	{
+		load(priority);
+	}
+}
+
+void YouTube::UI::Thumbnail::release()
+{
+	if (loading())
+		ctx.cancel();
+}
+
+auto YouTube::UI::Thumbnail::display(ActualPixelsRectangle clipping, ThumbnailAtlas::Batch& batch) -> ActualPixelsSize
+{
+	settle();
+	// a pending load keeps the priority HomeTab gave it by distance from the focus
+	if (!loading() && (thumbnail.expired() || outgrown()))
+		// not requested yet, released, evicted or loaded for a smaller window
+		want(priority);
+	// a failed reload keeps showing the smaller image
+	else if (previous && !loading() && !failed)
+		previous = nullptr;
+
+	auto image = current();
+	if (!image)
 		return clipping.size;
 
-	auto srcrect = calculate_projection_rect(size, clipping.size);
-	g_Renderer.CopyTexture(thumbnail.get(), srcrect, clipping);
+	// decoded at display size rather than the variant's
+	auto srcrect = calculate_projection_rect(ActualPixelsSize{ image->rect.w, image->rect.h }, clipping.size);
+	batch.Add(*image, srcrect, SDL_Rect{ clipping.pos.x, clipping.pos.y, clipping.size.w, clipping.size.h });
 
 	return clipping.size;
 }
+
+auto YouTube::UI::Thumbnail::version() const -> uintptr_t
+{
+	auto image = current();
+	if (image)
+	{
+		g_TextureManager.Touch(image->texture.get());
+		g_ImageManager.Touch(image_url);
+	}
+	return reinterpret_cast<uintptr_t>(image.get());
+}
@@ -3,6 +3,7 @@
 #include <memory>
 
 #include <cpprest/http_client.h>
+#include <nlohmann/json.hpp>
 
 #include "Renderer.h"
 
@@ -43,9 +44,16 @@ namespace YouTube::UI
 	{
 	public:
 		MainMenu();
+		MainMenu(std::unique_ptr<BasicElement> content);
 		virtual auto display(ActualPixelsRectangle clipping) -> ActualPixelsSize;
 
 	private:
 		std::unique_ptr<BasicElement> main_content;
 	};
+
+	// Builds home tab straight from tabRenderer data, bypassing the API
+	auto make_home_tab(const nlohmann::json& data) -> std::unique_ptr<BasicElement>;
+
+	// Rasterizes common characters of every text style in the background
+	void prewarm_text();
 }
\ No newline at end of file
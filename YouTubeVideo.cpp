@@ -2,6 +2,9 @@
 
 #include "YouTubeVideo.h"
 
+#include "YouTubeCore.h"
+#include "TextureManager.h"
+
 #pragma comment(lib, "avcodec.lib")
 #pragma comment(lib, "avformat.lib")
 #pragma comment(lib, "swscale.lib")
@@ -63,6 +66,8 @@ VideoStream::VideoStream(const string& _url, GuardedRenderer& _renderer, const C
 	auto [lc, renderer_ptr] = renderer.get_renderer();
 	current_frame = unique_ptr<SDL_Texture>{ SDL_CreateTexture(renderer_ptr, SDL_PIXELFORMAT_YV12, SDL_TEXTUREACCESS_STATIC, codec_ctx->width, codec_ctx->height) };
 	back_buffer = unique_ptr<SDL_Texture>{ SDL_CreateTexture(renderer_ptr, SDL_PIXELFORMAT_YV12, SDL_TEXTUREACCESS_STATIC, codec_ctx->width, codec_ctx->height) };
+	YouTube::g_TextureManager.Register(current_frame.get(), TextureManager::Category::VideoFrame);
+	YouTube::g_TextureManager.Register(back_buffer.get(), TextureManager::Category::VideoFrame);
 }
 
 void VideoStream::start()